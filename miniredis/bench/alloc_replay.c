@@ -0,0 +1,160 @@
+// Node allocation replay: the slab allocator against plain glibc malloc.
+// A deterministic trace of node-sized allocations and frees is generated
+// once, then replayed by each allocator in its own process, so RSS is
+// measured separately. The trace has three phases:
+//   fill       every key gets a small value (32-128 bytes)
+//   overwrite  random keys are overwritten with values of 16-1024 bytes,
+//              and one write in eight deletes a key instead
+//   shrink     75% of the keys are deleted
+//   clear      the rest are deleted
+// After each phase the heap is trimmed (as the server cron does) and the
+// live bytes, RSS and their ratio are reported. A slab page only goes back
+// once every chunk in it is free, so random deletes (shrink) return little
+// while clearing everything returns nearly all of it.
+//
+//   bin/bench/alloc_replay [keys] [overwrites per key]
+
+#include "bench.h"
+#include "mem.h"
+#include "slab.h"
+#include "store.h"
+
+typedef struct Op {
+    uint32_t key;
+    uint32_t size; // 0 = free the key's block
+} Op;
+
+typedef struct Trace {
+    Op *ops;
+    size_t n, cap;
+    size_t phase_end[4];
+} Trace;
+
+static const char *const k_phases[] = {"fill", "overwrite", "shrink", "clear"};
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dull;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Block size of a node with a 16-byte key and `vlen` bytes of value
+static uint32_t node_size(uint32_t vlen) {
+    return sizeof(HNode) + 16 + 1 + vlen + 1;
+}
+
+static void push(Trace *t, uint32_t key, uint32_t size) {
+    if (t->n == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 1 << 20;
+        t->ops = realloc(t->ops, t->cap * sizeof(Op));
+    }
+    t->ops[t->n++] = (Op){key, size};
+}
+
+static void build_trace(Trace *t, uint32_t nkeys, uint32_t rounds) {
+    char *live = calloc(nkeys, 1);
+    for (uint32_t k = 0; k < nkeys; k++) {
+        push(t, k, node_size(32 + rng_next() % 97));
+        live[k] = 1;
+    }
+    t->phase_end[0] = t->n;
+
+    for (uint64_t i = 0; i < (uint64_t)nkeys * rounds; i++) {
+        uint32_t k = rng_next() % nkeys;
+        if (live[k]) push(t, k, 0);
+        if (rng_next() % 8 == 0) {
+            live[k] = 0;
+        } else {
+            push(t, k, node_size(16 + rng_next() % 1009));
+            live[k] = 1;
+        }
+    }
+    t->phase_end[1] = t->n;
+
+    for (uint32_t k = 0; k < nkeys; k++) {
+        if (live[k] && rng_next() % 4 != 0) {
+            push(t, k, 0);
+            live[k] = 0;
+        }
+    }
+    t->phase_end[2] = t->n;
+
+    for (uint32_t k = 0; k < nkeys; k++) {
+        if (live[k]) push(t, k, 0);
+    }
+    t->phase_end[3] = t->n;
+    free(live);
+}
+
+// Replay with the slab (use_slab) or malloc, printing one line per phase
+static void replay(const Trace *t, uint32_t nkeys, int use_slab) {
+    void **blocks = calloc(nkeys, sizeof(void *));
+    uint32_t *sizes = calloc(nkeys, sizeof(uint32_t));
+    Slab slab;
+    slab_init(&slab, 1);
+    size_t live = 0, pos = 0;
+    // Bookkeeping is resident before the baseline is taken
+    memset(blocks, 0, nkeys * sizeof(void *));
+    memset(sizes, 0, nkeys * sizeof(uint32_t));
+    size_t base_rss = mem_rss();
+
+    for (int phase = 0; phase < 4; phase++) {
+        uint64_t t0 = now_ns();
+        for (; pos < t->phase_end[phase]; pos++) {
+            const Op *op = &t->ops[pos];
+            if (op->size == 0) {
+                if (use_slab) {
+                    slab_free(&slab, blocks[op->key], sizes[op->key]);
+                } else {
+                    free(blocks[op->key]);
+                }
+                live -= sizes[op->key];
+                blocks[op->key] = NULL;
+                continue;
+            }
+            char *p = use_slab ? slab_alloc(&slab, op->size) : malloc(op->size);
+            if (!p) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            memset(p, 0xab, op->size); // Written like a node is
+            blocks[op->key] = p;
+            sizes[op->key] = op->size;
+            live += op->size;
+        }
+        double secs = (now_ns() - t0) / 1e9;
+        size_t nops = t->phase_end[phase] - (phase ? t->phase_end[phase - 1] : 0);
+        mem_trim();
+        size_t rss = mem_rss() - base_rss;
+        printf("%-6s %-10s %12.0f %10.1f %10.1f %8.2f\n", use_slab ? "slab" : "malloc",
+               k_phases[phase], nops / secs, live / 1048576.0, rss / 1048576.0,
+               live ? (double)rss / live : 0.0);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    uint32_t nkeys = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+    uint32_t rounds = argc > 2 ? (uint32_t)atol(argv[2]) : 4;
+
+    Trace trace = {0};
+    build_trace(&trace, nkeys, rounds);
+
+    printf("%zu operations over %u keys\n", trace.n, nkeys);
+    printf("%-6s %-10s %12s %10s %10s %8s\n", "alloc", "phase", "ops/s", "live_MB", "rss_MB",
+           "rss/live");
+    fflush(stdout); // Before the children inherit the buffer
+    for (int use_slab = 1; use_slab >= 0; use_slab--) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            replay(&trace, nkeys, use_slab);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    free(trace.ops);
+    return 0;
+}
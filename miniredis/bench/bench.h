@@ -0,0 +1,217 @@
+#ifndef MINIREDIS_BENCH_H
+#define MINIREDIS_BENCH_H
+
+// Helpers shared by the benchmarks: clocks, percentiles, and a tiny
+// blocking RESP client for the ones that drive a real server.
+// The server under test is started in a scratch directory (its AOF goes
+// there) on BENCH_PORT and killed afterwards.
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SERVER_BIN
+#define SERVER_BIN "bin/miniredis-server"
+#endif
+#define BENCH_PORT "7390"
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// p-th percentile (0..100) of n samples; sorts them
+static inline uint64_t percentile(uint64_t *v, size_t n, double p) {
+    if (n == 0) return 0;
+    qsort(v, n, sizeof(*v), cmp_u64);
+    size_t i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+    return v[i < n ? i : n - 1];
+}
+
+// Allow as many descriptors as the hard limit (inherited by the server)
+static inline void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Blocking connection to the local server, or -1
+static inline int bench_connect(void) {
+    struct addrinfo hints = {0}, *ai;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", BENCH_PORT, &hints, &ai) != 0) return -1;
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    if (fd != -1) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return fd;
+}
+
+typedef struct BenchServer {
+    pid_t pid;
+    char dir[64];
+} BenchServer;
+
+// Start the server with extra "--name value" arguments (NULL-terminated)
+// and wait until it accepts connections. Exits on failure.
+static inline void bench_server_start(BenchServer *srv, const char *const *args) {
+    const char *argv[64];
+    int argc = 0;
+    argv[argc++] = SERVER_BIN;
+    argv[argc++] = "--port";
+    argv[argc++] = BENCH_PORT;
+    while (args && *args && argc < 63) argv[argc++] = *args++;
+    argv[argc] = NULL;
+
+    strcpy(srv->dir, "/tmp/miniredis-bench-XXXXXX");
+    if (!mkdtemp(srv->dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    srv->pid = fork();
+    if (srv->pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (srv->pid == 0) {
+        if (chdir(srv->dir) == -1) _exit(1);
+        if (!freopen("/dev/null", "w", stdout)) _exit(1);
+        execv(argv[0], (char *const *)argv);
+        perror("execv " SERVER_BIN);
+        _exit(1);
+    }
+    for (int i = 0; i < 500; i++) {
+        int fd = bench_connect();
+        if (fd != -1) {
+            close(fd);
+            return;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "server did not come up on port %s\n", BENCH_PORT);
+    kill(srv->pid, SIGKILL);
+    exit(1);
+}
+
+static inline void bench_server_stop(BenchServer *srv) {
+    char path[128];
+    kill(srv->pid, SIGKILL);
+    waitpid(srv->pid, NULL, 0);
+    snprintf(path, sizeof(path), "%s/database.aof", srv->dir);
+    unlink(path);
+    rmdir(srv->dir);
+}
+
+// CPU time (user + system) the server has used, in microseconds
+static inline uint64_t bench_server_cpu_us(const BenchServer *srv) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)srv->pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // Fields 14 and 15, counted after the ")" closing the command name
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2) {
+        return 0;
+    }
+    return (uint64_t)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+// Append a command in RESP form to buf; returns the new length
+static inline size_t resp_command(char *buf, size_t len, int argc, const char *const *argv) {
+    len += sprintf(buf + len, "*%d\r\n", argc);
+    for (int i = 0; i < argc; i++) {
+        len += sprintf(buf + len, "$%zu\r\n%s\r\n", strlen(argv[i]), argv[i]);
+    }
+    return len;
+}
+
+// Length of the complete reply at the front of buf, or 0 if incomplete
+static inline size_t resp_reply_len(const char *buf, size_t len) {
+    const char *end = memchr(buf, '\n', len);
+    if (!end) return 0;
+    size_t head = end - buf + 1;
+    long n = strtol(buf + 1, NULL, 10);
+    if (buf[0] == '$') {
+        if (n < 0) return head;
+        return head + n + 2 <= len ? head + n + 2 : 0;
+    }
+    if (buf[0] == '*') {
+        size_t off = head;
+        for (long i = 0; i < n; i++) {
+            size_t r = resp_reply_len(buf + off, len - off);
+            if (!r) return 0;
+            off += r;
+        }
+        return off;
+    }
+    return head; // +, -, :
+}
+
+static inline int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read until `count` complete replies have arrived (their bytes are
+// discarded). buf is scratch space of `cap` bytes. Returns -1 on error.
+static inline int read_replies(int fd, char *buf, size_t cap, long count) {
+    size_t used = 0;
+    while (count > 0) {
+        ssize_t n = read(fd, buf + used, cap - used);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return -1;
+        }
+        used += n;
+        size_t off = 0, r;
+        while (count > 0 && off < used && (r = resp_reply_len(buf + off, used - off)) > 0) {
+            off += r;
+            count--;
+        }
+        memmove(buf, buf + off, used - off);
+        used -= off;
+        if (used == cap) return -1; // A single reply bigger than buf
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,229 @@
+// Eviction quality: cache hit ratio under maxmemory on a Zipfian access
+// trace, for the sampled LRU and LFU policies, against an exact LRU cache
+// holding the same number of keys.
+// Each request is a cache-aside read: GET the key and, on a miss, SET it
+// (evicting first, as the server does before a write). The trace runs in
+// simulated time at a fixed request rate (the LRU clock ticks in seconds,
+// the LFU decay in minutes), starting from the most popular keys loaded.
+// Every policy runs in its own process with a fresh store.
+//
+//   bin/bench/eviction [keys] [cache %] [requests] [zipf s] [requests/s]
+
+#include <math.h>
+#include "bench.h"
+#include "store.h"
+
+#define VALUE_LEN 100
+
+typedef struct Params {
+    uint32_t nkeys;
+    uint32_t cache_keys; // Keys that fit under maxmemory at the start
+    long warmup;         // Requests before counting hits
+    long requests;
+    double zipf_s;
+    long rate;           // Simulated requests per second
+} Params;
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Zipfian ranks by inverse CDF: rank 0 is the most popular key
+static double *zipf_cdf(uint32_t n, double s) {
+    double *cdf = malloc(n * sizeof(double)), sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sum += 1.0 / pow(i + 1, s);
+        cdf[i] = sum;
+    }
+    for (uint32_t i = 0; i < n; i++) cdf[i] /= sum;
+    return cdf;
+}
+
+static uint32_t zipf_next(const double *cdf, uint32_t n) {
+    double u = (double)(rng_next() >> 11) / (double)(1ull << 53);
+    uint32_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// The same trace for every run
+static uint32_t *build_trace(const Params *p) {
+    double *cdf = zipf_cdf(p->nkeys, p->zipf_s);
+    long total = p->warmup + p->requests;
+    uint32_t *trace = malloc(total * sizeof(uint32_t));
+    rng_state = 0x853c49e6748fea9bull;
+    for (long i = 0; i < total; i++) trace[i] = zipf_next(cdf, p->nkeys);
+    free(cdf);
+    return trace;
+}
+
+static Slice key_of(char *buf, uint32_t k) {
+    return (Slice){buf, (size_t)sprintf(buf, "key:%u", k)};
+}
+
+static size_t store_keys(void) {
+    size_t n = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) n += hmap_size(store_map((uint64_t)i << 60));
+    return n;
+}
+
+// Exact LRU over key ids with room for `cap` keys; returns the hit ratio
+// over the requests after the warmup
+static double true_lru(const Params *p, const uint32_t *trace, uint32_t cap) {
+    uint32_t *prev = malloc(p->nkeys * sizeof(uint32_t));
+    uint32_t *next = malloc(p->nkeys * sizeof(uint32_t));
+    char *in = calloc(p->nkeys, 1);
+    const uint32_t none = UINT32_MAX;
+    uint32_t head = none, tail = none, size = 0; // head = most recent
+    long hits = 0;
+
+    // Same starting content as the store: the most popular keys, the
+    // first one most recently used
+    for (uint32_t k = cap < p->cache_keys ? cap : p->cache_keys; k-- > 0; size++) {
+        in[k] = 1;
+        prev[k] = none;
+        next[k] = head;
+        if (head != none) prev[head] = k;
+        head = k;
+        if (tail == none) tail = k;
+    }
+
+    for (long i = 0; i < p->warmup + p->requests; i++) {
+        uint32_t k = trace[i];
+        if (in[k]) {
+            if (i >= p->warmup) hits++;
+            if (k == head) continue;
+            // Unlink
+            next[prev[k]] = next[k];
+            if (next[k] != none) {
+                prev[next[k]] = prev[k];
+            } else {
+                tail = prev[k];
+            }
+        } else {
+            if (size == cap) {
+                uint32_t victim = tail;
+                tail = prev[victim];
+                if (tail != none) {
+                    next[tail] = none;
+                } else {
+                    head = none;
+                }
+                in[victim] = 0;
+                size--;
+            }
+            in[k] = 1;
+            size++;
+        }
+        // Push front
+        prev[k] = none;
+        next[k] = head;
+        if (head != none) prev[head] = k;
+        head = k;
+        if (tail == none) tail = k;
+    }
+    free(prev);
+    free(next);
+    free(in);
+    return (double)hits / p->requests;
+}
+
+// Run the trace against the store; prints the hit ratio and the average
+// number of keys it held, then the exact LRU result for that many keys
+static void run_policy(const Params *p, const uint32_t *trace, const char *name, int policy,
+                       int samples) {
+    char buf[32], value[VALUE_LEN];
+    memset(value, 'v', sizeof(value));
+    int64_t ms = 1700000000000LL; // Simulated clock
+    store_init();
+    store_set_clock(ms);
+
+    // Load the most popular keys, then cap memory at what they take
+    for (uint32_t k = p->cache_keys; k-- > 0;) {
+        Slice key = key_of(buf, k);
+        HMap *map = store_lock(key);
+        hmap_insert(map, key, (Slice){value, VALUE_LEN});
+        store_unlock(map);
+    }
+    store_set_maxmemory(store_used_memory(), policy, samples);
+
+    long hits = 0;
+    double resident = 0;
+    long resident_samples = 0;
+    for (long i = 0; i < p->warmup + p->requests; i++) {
+        if (i % 100 == 0) store_set_clock(ms + i * 1000 / p->rate);
+        Slice key = key_of(buf, trace[i]);
+
+        HMap *map = store_lock(key);
+        int hit = hmap_lookup(map, key) != NULL;
+        store_unlock(map);
+        if (!hit) {
+            store_evict();
+            map = store_lock(key);
+            hmap_insert(map, key, (Slice){value, VALUE_LEN});
+            store_unlock(map);
+        }
+        if (i >= p->warmup) {
+            hits += hit;
+            if (i % 1000 == 0) {
+                resident += store_keys();
+                resident_samples++;
+            }
+        }
+    }
+    uint32_t cap = (uint32_t)(resident / resident_samples + 0.5);
+    double ratio = (double)hits / p->requests;
+    double lru = true_lru(p, trace, cap);
+    printf("%-12s %8d %10u %10.4f %10.4f %8.3f\n", name, samples, cap, ratio, lru, ratio / lru);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    Params p;
+    p.nkeys = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+    double pct = argc > 2 ? atof(argv[2]) : 10;
+    p.requests = argc > 3 ? atol(argv[3]) : 10000000;
+    p.zipf_s = argc > 4 ? atof(argv[4]) : 0.99;
+    p.rate = argc > 5 ? atol(argv[5]) : 100000;
+    p.cache_keys = (uint32_t)(p.nkeys * pct / 100);
+    p.warmup = p.requests / 2;
+
+    static const struct {
+        const char *name;
+        int policy, samples;
+    } k_runs[] = {
+        {"allkeys-lru", EVICT_ALLKEYS_LRU, 5},
+        {"allkeys-lru", EVICT_ALLKEYS_LRU, 10},
+        {"allkeys-lfu", EVICT_ALLKEYS_LFU, 5},
+        {"allkeys-lfu", EVICT_ALLKEYS_LFU, 10},
+    };
+
+    uint32_t *trace = build_trace(&p);
+    printf("%u keys, %.1f%% cached, %ld requests (+%ld warmup), zipf s=%.2f, %ld req/s\n",
+           p.nkeys, pct, p.requests, p.warmup, p.zipf_s, p.rate);
+    printf("%-12s %8s %10s %10s %10s %8s\n", "policy", "samples", "keys", "hit_ratio",
+           "true_lru", "vs_lru");
+    fflush(stdout); // Before the children inherit the buffer
+    for (size_t r = 0; r < sizeof(k_runs) / sizeof(k_runs[0]); r++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_policy(&p, trace, k_runs[r].name, k_runs[r].policy, k_runs[r].samples);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    free(trace);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Key hash throughput: hmap_hash against 64-bit FNV-1a (byte at a time,
+// the usual simple choice) for key lengths from 3 to 256 bytes. Each round
+// hashes a ring of distinct keys so nothing can be hoisted out of the loop.
+//
+//   bin/bench/hash [million hashes per length]
+
+#include "bench.h"
+#include "store.h"
+
+#define RING 4096 // Keys per length, cycled through
+
+static const size_t k_lengths[] = {3, 8, 16, 24, 32, 64, 128, 256};
+static volatile uint64_t g_sink; // Keeps the results live
+
+static uint64_t fnv1a(const char *data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Nanoseconds per hash
+static double time_hash(int use_fnv, const char *keys, size_t len, long n) {
+    uint64_t acc = 0;
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < n; i++) {
+        const char *key = keys + (i & (RING - 1)) * len;
+        acc ^= use_fnv ? fnv1a(key, len) : hmap_hash((Slice){key, len});
+    }
+    g_sink ^= acc;
+    return (double)(now_ns() - t0) / n;
+}
+
+int main(int argc, char **argv) {
+    long n = (argc > 1 ? atol(argv[1]) : 20) * 1000000L;
+    HMap seed; // hmap_init picks the hash seed
+    hmap_init(&seed);
+
+    printf("%6s %12s %10s %12s %10s %8s\n", "bytes", "hmap ns", "hmap GB/s", "fnv1a ns",
+           "fnv GB/s", "speedup");
+    for (size_t l = 0; l < sizeof(k_lengths) / sizeof(k_lengths[0]); l++) {
+        size_t len = k_lengths[l];
+        char *keys = malloc(RING * len);
+        for (size_t i = 0; i < RING * len; i++) keys[i] = 'a' + (char)((i * 7 + i / len) % 26);
+
+        double ours = time_hash(0, keys, len, n);
+        double fnv = time_hash(1, keys, len, n);
+        printf("%6zu %12.2f %10.2f %12.2f %10.2f %7.1fx\n", len, ours, len / ours, fnv,
+               len / fnv, fnv / ours);
+        free(keys);
+    }
+    hmap_destroy(&seed);
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Hash table engine comparison. Built once per engine (hmap_engines-chained
+// and hmap_engines-swiss); run both with the same sizes and compare.
+// For each size: fill a map, then time random lookups of present keys
+// (hits) and absent ones (misses), and report the memory per key held by
+// nodes (slab pages) and by the table arrays.
+//
+//   bin/bench/hmap_engines-chained [keys ...]   (default 1M 10M 50M)
+
+#include "bench.h"
+#include "mem.h"
+#include "store.h"
+
+#ifdef HMAP_SWISS
+#define ENGINE "swiss"
+#else
+#define ENGINE "chained"
+#endif
+
+#define KEY_LEN 16
+#define LOOKUPS (4 * 1000 * 1000)
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void make_key(char *out, const char *prefix, long i) {
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "%s%012ld", prefix, i);
+    memcpy(out, tmp, KEY_LEN);
+}
+
+// Lookups per second over `keys` (LOOKUPS keys of KEY_LEN bytes).
+// Returns how many were found through *found.
+static double time_lookups(HMap *map, const char *keys, long *found) {
+    long hits = 0;
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < LOOKUPS; i++) {
+        hits += hmap_lookup(map, (Slice){keys + i * KEY_LEN, KEY_LEN}) != NULL;
+    }
+    double secs = (now_ns() - t0) / 1e9;
+    *found = hits;
+    return LOOKUPS / secs;
+}
+
+static void run(long n, char *keys) {
+    HMap map;
+    hmap_init(&map);
+    size_t nodes0 = mem_used(MEM_NODES), tables0 = mem_used(MEM_TABLES);
+
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < n; i++) {
+        char key[KEY_LEN];
+        make_key(key, "key:", i);
+        hmap_insert(&map, (Slice){key, KEY_LEN}, (Slice){"12345678abcdefgh", 16});
+    }
+    double insert_rate = n / ((now_ns() - t0) / 1e9);
+    while (hmap_rehash(&map, SIZE_MAX)) {} // Measure the settled table
+
+    double node_bytes = (double)(mem_used(MEM_NODES) - nodes0) / n;
+    double table_bytes = (double)(mem_used(MEM_TABLES) - tables0) / n;
+
+    long found;
+    for (long i = 0; i < LOOKUPS; i++) make_key(keys + i * KEY_LEN, "key:", rng_next() % n);
+    double hit_rate = time_lookups(&map, keys, &found);
+    if (found != LOOKUPS) {
+        fprintf(stderr, "only %ld of %d present keys found\n", found, LOOKUPS);
+        exit(1);
+    }
+    for (long i = 0; i < LOOKUPS; i++) make_key(keys + i * KEY_LEN, "nok:", rng_next() % n);
+    double miss_rate = time_lookups(&map, keys, &found);
+
+    printf("%-8s %10ld %12.0f %12.0f %12.0f %10.1f %10.1f %10.1f\n", ENGINE, n, insert_rate,
+           hit_rate, miss_rate, node_bytes, table_bytes, node_bytes + table_bytes);
+    hmap_destroy(&map);
+}
+
+int main(int argc, char **argv) {
+    static const long k_default_sizes[] = {1000000, 10000000, 50000000};
+    char *keys = malloc((size_t)LOOKUPS * KEY_LEN);
+
+    printf("%-8s %10s %12s %12s %12s %10s %10s %10s\n", "engine", "keys", "inserts/s",
+           "hits/s", "misses/s", "node_B/key", "table_B/key", "total_B/key");
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) run(atol(argv[i]), keys);
+    } else {
+        for (size_t i = 0; i < sizeof(k_default_sizes) / sizeof(k_default_sizes[0]); i++) {
+            run(k_default_sizes[i], keys);
+        }
+    }
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Wakeup cost against idle connections (epoll reactor).
+// Opens more and more idle clients, then times PING round trips from one
+// active client and the server CPU spent per request. With epoll both
+// stay flat as idle connections grow from 100 to 10k; a poll() loop
+// scanning every descriptor grows linearly.
+//
+//   bin/bench/idle_wakeup [requests]
+
+#include "bench.h"
+
+static const int k_idle_steps[] = {100, 1000, 10000};
+
+int main(int argc, char **argv) {
+    long requests = argc > 1 ? atol(argv[1]) : 20000;
+    raise_fd_limit();
+
+    BenchServer srv;
+    bench_server_start(&srv, NULL);
+
+    static int idle[10000];
+    int nidle = 0;
+    int active = bench_connect();
+    if (active == -1) {
+        perror("connect");
+        return 1;
+    }
+
+    static const char ping[] = "*1\r\n$4\r\nPING\r\n";
+    char buf[256];
+    uint64_t *lat = malloc(requests * sizeof(uint64_t));
+
+    printf("%8s %10s %10s %10s %14s\n", "idle", "p50_us", "p99_us", "mean_us", "server_cpu_us");
+    for (size_t s = 0; s < sizeof(k_idle_steps) / sizeof(k_idle_steps[0]); s++) {
+        while (nidle < k_idle_steps[s]) {
+            int fd = bench_connect();
+            if (fd == -1) {
+                fprintf(stderr, "connect failed at %d idle clients: %s\n", nidle, strerror(errno));
+                goto out;
+            }
+            idle[nidle++] = fd;
+        }
+        // Make sure the server has accepted them all before timing
+        usleep(200000);
+
+        uint64_t cpu0 = bench_server_cpu_us(&srv);
+        uint64_t total = 0;
+        for (long i = 0; i < requests; i++) {
+            uint64_t t0 = now_ns();
+            if (send_all(active, ping, sizeof(ping) - 1) == -1 ||
+                read_replies(active, buf, sizeof(buf), 1) == -1) {
+                fprintf(stderr, "lost the connection\n");
+                goto out;
+            }
+            lat[i] = now_ns() - t0;
+            total += lat[i];
+        }
+        uint64_t cpu = bench_server_cpu_us(&srv) - cpu0;
+        double mean = total / 1000.0 / requests;
+        uint64_t p99 = percentile(lat, requests, 99);
+        uint64_t p50 = percentile(lat, requests, 50);
+        printf("%8d %10.1f %10.1f %10.1f %14.2f\n", nidle, p50 / 1000.0, p99 / 1000.0,
+               mean, (double)cpu / requests);
+    }
+
+out:
+    for (int i = 0; i < nidle; i++) close(idle[i]);
+    close(active);
+    free(lat);
+    bench_server_stop(&srv);
+    return 0;
+}
@@ -0,0 +1,145 @@
+// RESP parser throughput over a pipelined batch of commands.
+// Each workload is parsed with the scalar CRLF scanner and then with the
+// one resp_init() picks for this CPU, once as a single buffer and once fed
+// in 16KB reads the way a socket delivers it (partial frames resume).
+//
+//   bin/bench/parser [MB per workload]
+
+#include "bench.h"
+#include "resp.h"
+
+#define READ_SIZE (16 * 1024)
+
+typedef struct Workload {
+    const char *name;
+    int nargs;      // Key/value pairs after the command name
+    size_t vlen;    // 0 for GET
+} Workload;
+
+static const Workload k_workloads[] = {
+    {"GET 16B key", 1, 0},
+    {"SET 64B value", 1, 64},
+    {"SET 1KB value", 1, 1024},
+    {"MSET 10 x 64B", 10, 64},
+};
+
+// Fill about `size` bytes with copies of one workload's commands
+static char *build_batch(const Workload *w, size_t size, size_t *len, long *ncmds) {
+    char *buf = malloc(size + 64 * 1024);
+    char *value = malloc(w->vlen + 1);
+    memset(value, 'v', w->vlen);
+    value[w->vlen] = '\0';
+
+    *len = 0;
+    *ncmds = 0;
+    while (*len < size) {
+        const char *argv[1 + 2 * 10];
+        char keys[10][32];
+        int argc = 0;
+        argv[argc++] = w->vlen == 0 ? "GET" : w->nargs > 1 ? "MSET" : "SET";
+        for (int i = 0; i < w->nargs; i++) {
+            snprintf(keys[i], sizeof(keys[i]), "key:%012ld", *ncmds * w->nargs + i);
+            argv[argc++] = keys[i];
+            if (w->vlen) argv[argc++] = value;
+        }
+        *len = resp_command(buf, *len, argc, argv);
+        (*ncmds)++;
+    }
+    free(value);
+    return buf;
+}
+
+// Parse everything in buf[0..len) the way process_input does. Returns the
+// number of commands parsed, or -1 on a parse error.
+static long parse_all(RespParser *p, char *buf, size_t len) {
+    size_t pos = 0;
+    long n = 0;
+    while (pos < len) {
+        RedisCmd cmd;
+        size_t avail = len - pos;
+        int consumed = resp_parse(p, buf + pos, &avail, &cmd);
+        if (consumed <= 0) return consumed == 0 ? n : -1;
+        free_redis_cmd(&cmd);
+        resp_parser_reset(p);
+        pos += consumed;
+        n++;
+    }
+    return n;
+}
+
+// Feed the batch in READ_SIZE pieces through a read buffer, keeping a
+// trailing partial frame (and the parser's progress) between reads
+static long parse_chunked(RespParser *p, const char *batch, size_t len, char *rbuf) {
+    size_t used = 0, off = 0;
+    long n = 0;
+    while (off < len) {
+        size_t r = len - off < READ_SIZE ? len - off : READ_SIZE;
+        memcpy(rbuf + used, batch + off, r);
+        used += r;
+        off += r;
+
+        size_t pos = 0;
+        while (pos < used) {
+            RedisCmd cmd;
+            size_t avail = used - pos;
+            int consumed = resp_parse(p, rbuf + pos, &avail, &cmd);
+            if (consumed < 0) return -1;
+            if (consumed == 0) break;
+            free_redis_cmd(&cmd);
+            resp_parser_reset(p);
+            pos += consumed;
+            n++;
+        }
+        memmove(rbuf, rbuf + pos, used - pos);
+        used -= pos;
+    }
+    return n;
+}
+
+static void run(const char *scanner, const Workload *w, char *batch, size_t len,
+                long ncmds, char *rbuf) {
+    for (int chunked = 0; chunked <= 1; chunked++) {
+        double best = 0;
+        for (int rep = 0; rep < 3; rep++) {
+            RespParser p;
+            resp_parser_init(&p, 0);
+            uint64_t t0 = now_ns();
+            long n = chunked ? parse_chunked(&p, batch, len, rbuf) : parse_all(&p, batch, len);
+            double secs = (now_ns() - t0) / 1e9;
+            resp_parser_reset(&p);
+            if (n != ncmds) {
+                fprintf(stderr, "%s: parsed %ld of %ld commands\n", w->name, n, ncmds);
+                exit(1);
+            }
+            if (best == 0 || secs < best) best = secs;
+        }
+        printf("%-16s %-8s %-7s %10.2f %10.1f\n", w->name, scanner, chunked ? "16KB" : "whole",
+               ncmds / best / 1e6, len / best / (1 << 20));
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t size = (size_t)(argc > 1 ? atol(argv[1]) : 32) << 20;
+    size_t nw = sizeof(k_workloads) / sizeof(k_workloads[0]);
+    char *batches[sizeof(k_workloads) / sizeof(k_workloads[0])];
+    size_t lens[sizeof(k_workloads) / sizeof(k_workloads[0])];
+    long ncmds[sizeof(k_workloads) / sizeof(k_workloads[0])];
+    char *rbuf = malloc(2 * READ_SIZE + 64 * 1024);
+
+    for (size_t i = 0; i < nw; i++) {
+        batches[i] = build_batch(&k_workloads[i], size, &lens[i], &ncmds[i]);
+    }
+
+    printf("%-16s %-8s %-7s %10s %10s\n", "workload", "crlf", "feed", "Mcmds/s", "MB/s");
+    // find_crlf starts out scalar; resp_init() switches to SSE2/AVX2
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) resp_init();
+        for (size_t i = 0; i < nw; i++) {
+            run(pass == 0 ? "scalar" : "best", &k_workloads[i], batches[i], lens[i], ncmds[i], rbuf);
+        }
+    }
+
+    for (size_t i = 0; i < nw; i++) free(batches[i]);
+    free(rbuf);
+    return 0;
+}
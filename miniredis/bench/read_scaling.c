@@ -0,0 +1,134 @@
+// GET scaling with one busy writer: N reader threads look up random keys
+// (copying the value out, as a reply would) while one thread SETs random
+// keys nonstop, with lock-free reads on and off. Reports GETs/s over all
+// readers and the writer's SETs/s, for 1, 2, 4 and 8 readers. Each run is
+// its own process with a fresh store (lock-free reads can't be turned off).
+//
+//   bin/bench/read_scaling [keys] [seconds per run]
+
+#include <pthread.h>
+#include "bench.h"
+#include "store.h"
+
+#define VALUE_LEN 64
+
+typedef struct Worker {
+    pthread_t tid;
+    uint64_t rng;
+    uint32_t nkeys;
+    int lockfree;
+    long ops; // Atomic
+} Worker;
+
+static volatile int g_stop;
+
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void *reader_main(void *arg) {
+    Worker *w = arg;
+    char key[32], out[VALUE_LEN];
+    if (w->lockfree) store_thread_init();
+    while (!g_stop) {
+        for (int i = 0; i < 64; i++) {
+            Slice k = {key, (size_t)sprintf(key, "key:%u", (uint32_t)(rng_next(&w->rng) % w->nkeys))};
+            HNode *node;
+            store_read_begin();
+            int done = store_lookup_lockfree(k, &node);
+            if (done && node) memcpy(out, hnode_value(node), node->vlen);
+            store_read_end();
+            if (!done) {
+                HMap *map = store_lock(k);
+                node = hmap_lookup(map, k);
+                if (node) memcpy(out, hnode_value(node), node->vlen);
+                store_unlock(map);
+            }
+        }
+        __atomic_add_fetch(&w->ops, 64, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *writer_main(void *arg) {
+    Worker *w = arg;
+    char key[32], value[VALUE_LEN];
+    memset(value, 'w', sizeof(value));
+    for (long i = 1; !g_stop; i++) {
+        Slice k = {key, (size_t)sprintf(key, "key:%u", (uint32_t)(rng_next(&w->rng) % w->nkeys))};
+        HMap *map = store_lock(k);
+        hmap_insert(map, k, (Slice){value, VALUE_LEN});
+        store_unlock(map);
+        if (i % 1024 == 0) {
+            store_reclaim(0, 1); // The server's cron does this
+            __atomic_add_fetch(&w->ops, 1024, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+static void run(uint32_t nkeys, double seconds, int nreaders, int lockfree) {
+    char key[32], value[VALUE_LEN];
+    memset(value, 'v', sizeof(value));
+    store_init();
+    if (lockfree && !store_enable_lockfree_reads()) {
+        printf("%-9s %8d  (not supported by this hash engine)\n", "lock-free", nreaders);
+        return;
+    }
+    for (uint32_t i = 0; i < nkeys; i++) {
+        Slice k = {key, (size_t)sprintf(key, "key:%u", i)};
+        HMap *map = store_lock(k);
+        hmap_insert(map, k, (Slice){value, VALUE_LEN});
+        store_unlock(map);
+    }
+
+    Worker *w = calloc(nreaders + 1, sizeof(Worker));
+    for (int i = 0; i <= nreaders; i++) {
+        w[i].rng = 0x9e3779b97f4a7c15ull * (i + 1);
+        w[i].nkeys = nkeys;
+        w[i].lockfree = lockfree;
+        pthread_create(&w[i].tid, NULL, i == 0 ? writer_main : reader_main, &w[i]);
+    }
+
+    usleep(200000); // Warm up
+    long start[9];
+    for (int i = 0; i <= nreaders; i++) start[i] = __atomic_load_n(&w[i].ops, __ATOMIC_RELAXED);
+    uint64_t t0 = now_ns();
+    usleep((useconds_t)(seconds * 1e6));
+    double secs = (now_ns() - t0) / 1e9;
+    long gets = 0;
+    for (int i = 1; i <= nreaders; i++) gets += __atomic_load_n(&w[i].ops, __ATOMIC_RELAXED) - start[i];
+    long sets = __atomic_load_n(&w[0].ops, __ATOMIC_RELAXED) - start[0];
+
+    g_stop = 1;
+    for (int i = 0; i <= nreaders; i++) pthread_join(w[i].tid, NULL);
+    printf("%-9s %8d %14.0f %14.0f %12.0f\n", lockfree ? "lock-free" : "locked", nreaders,
+           gets / secs, gets / secs / nreaders, sets / secs);
+    fflush(stdout);
+    free(w);
+}
+
+int main(int argc, char **argv) {
+    uint32_t nkeys = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+    static const int k_readers[] = {1, 2, 4, 8};
+
+    printf("%u keys, 1 writer, %.1fs per run, %ld CPUs\n", nkeys, seconds,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-9s %8s %14s %14s %12s\n", "reads", "readers", "GETs/s", "per reader", "SETs/s");
+    fflush(stdout); // Before the children inherit the buffer
+    for (int lockfree = 0; lockfree <= 1; lockfree++) {
+        for (size_t i = 0; i < sizeof(k_readers) / sizeof(k_readers[0]); i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                run(nkeys, seconds, k_readers[i], lockfree);
+                _exit(0);
+            }
+            waitpid(pid, NULL, 0);
+        }
+    }
+    return 0;
+}
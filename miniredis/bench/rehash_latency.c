@@ -0,0 +1,73 @@
+// SET latency while one hash map grows through many resizes.
+// Inserts N distinct keys and records the time of every insert, then
+// reports p50/p99/p99.9/max. "incremental" is the normal path, which moves
+// K_REHASH_BUCKETS buckets per operation; "blocking" finishes each resize
+// inside the insert that started it, as a one-shot rehash would.
+//
+//   bin/bench/rehash_latency [keys (default 50M)] [incremental|blocking]
+
+#include <inttypes.h>
+#include "bench.h"
+#include "mem.h"
+#include "store.h"
+
+// Latency histogram in 10ns steps up to 10ms; slower inserts only count
+// towards the max
+#define HIST_STEP_NS 10
+#define HIST_BUCKETS (10 * 1000 * 1000 / HIST_STEP_NS)
+
+static uint64_t hist_percentile(const uint32_t *hist, uint64_t total, double p) {
+    uint64_t want = (uint64_t)(p / 100.0 * total), seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > want) return i * HIST_STEP_NS;
+    }
+    return HIST_BUCKETS * HIST_STEP_NS;
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 50 * 1000 * 1000;
+    const char *mode = argc > 2 ? argv[2] : "incremental";
+    int blocking = strcmp(mode, "blocking") == 0;
+
+    uint32_t *hist = calloc(HIST_BUCKETS, sizeof(uint32_t));
+    uint64_t max_ns = 0, over = 0;
+    long next_report = 1 << 20;
+    HMap map;
+    hmap_init(&map);
+
+    printf("%s rehashing, %ld keys\n", mode, n);
+    uint64_t start = now_ns();
+    for (long i = 0; i < n; i++) {
+        char key[32];
+        int klen = snprintf(key, sizeof(key), "key:%012ld", i);
+
+        uint64_t t0 = now_ns();
+        hmap_insert(&map, (Slice){key, klen}, (Slice){"value-16-bytes!!", 16});
+        if (blocking) while (hmap_rehash(&map, SIZE_MAX)) {}
+        uint64_t dt = now_ns() - t0;
+
+        if (dt / HIST_STEP_NS < HIST_BUCKETS) {
+            hist[dt / HIST_STEP_NS]++;
+        } else {
+            over++;
+        }
+        if (dt > max_ns) max_ns = dt;
+
+        if (i + 1 == next_report || i + 1 == n) {
+            uint64_t total = i + 1 - over;
+            printf("%10ld keys  p50 %6.2fus  p99 %6.2fus  p99.9 %7.2fus  max %9.1fus  rss %6zuMB\n",
+                   i + 1, hist_percentile(hist, total, 50) / 1000.0,
+                   hist_percentile(hist, total, 99) / 1000.0,
+                   hist_percentile(hist, total, 99.9) / 1000.0, max_ns / 1000.0,
+                   mem_rss() >> 20);
+            next_report *= 2;
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+    printf("%.0f inserts/s, %" PRIu64 " inserts over 10ms\n", n / secs, over);
+
+    hmap_destroy(&map);
+    free(hist);
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Server throughput as threads are added: many clients, each on its own
+// connection, send pipelined batches of GETs and SETs (9:1) on a preloaded
+// keyspace. A fresh server runs with --threads 1, 2, 4 and 8 (or, in
+// io-threads mode, one event loop with --io-threads 1, 2, 4 and 8) and the
+// requests/s of each are reported, with the speedup over one thread.
+//
+//   bin/bench/throughput [seconds] [clients] [pipeline] [threads|io-threads]
+
+#include <pthread.h>
+#include "bench.h"
+
+#define NKEYS 100000
+#define VALUE_LEN 64
+
+typedef struct Client {
+    pthread_t tid;
+    int fd;
+    int pipeline;
+    uint64_t rng;
+    long done; // Requests answered (atomic)
+} Client;
+
+static volatile int g_stop;
+
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static size_t add_request(char *buf, size_t len, uint64_t *rng) {
+    static char value[VALUE_LEN + 1];
+    char key[32];
+    if (!value[0]) memset(value, 'v', VALUE_LEN);
+    uint64_t r = rng_next(rng);
+    snprintf(key, sizeof(key), "key:%llu", (unsigned long long)(r % NKEYS));
+    if ((r >> 32) % 10 == 0) {
+        const char *argv[] = {"SET", key, value};
+        return resp_command(buf, len, 3, argv);
+    }
+    const char *argv[] = {"GET", key};
+    return resp_command(buf, len, 2, argv);
+}
+
+static void *client_main(void *arg) {
+    Client *c = arg;
+    char *out = malloc(c->pipeline * 256);
+    char in[64 * 1024];
+    while (!g_stop) {
+        size_t len = 0;
+        for (int i = 0; i < c->pipeline; i++) len = add_request(out, len, &c->rng);
+        if (send_all(c->fd, out, len) == -1 || read_replies(c->fd, in, sizeof(in), c->pipeline) == -1) {
+            fprintf(stderr, "client lost its connection\n");
+            break;
+        }
+        __atomic_add_fetch(&c->done, c->pipeline, __ATOMIC_RELAXED);
+    }
+    free(out);
+    return NULL;
+}
+
+static void preload(void) {
+    int fd = bench_connect();
+    char *out = malloc(1000 * 256), in[64 * 1024];
+    char key[32], value[VALUE_LEN + 1];
+    memset(value, 'v', VALUE_LEN);
+    value[VALUE_LEN] = '\0';
+    for (int base = 0; base < NKEYS; base += 1000) {
+        size_t len = 0;
+        for (int i = base; i < base + 1000; i++) {
+            snprintf(key, sizeof(key), "key:%d", i);
+            const char *argv[] = {"SET", key, value};
+            len = resp_command(out, len, 3, argv);
+        }
+        if (send_all(fd, out, len) == -1 || read_replies(fd, in, sizeof(in), 1000) == -1) {
+            fprintf(stderr, "preload failed\n");
+            exit(1);
+        }
+    }
+    free(out);
+    close(fd);
+}
+
+static long total_done(Client *clients, int n) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) sum += __atomic_load_n(&clients[i].done, __ATOMIC_RELAXED);
+    return sum;
+}
+
+// Requests/s of one server configuration (extra server arguments)
+static double run(const char *const *args, double seconds, int nclients, int pipeline) {
+    BenchServer srv;
+    bench_server_start(&srv, args);
+    preload();
+
+    Client *clients = calloc(nclients, sizeof(Client));
+    g_stop = 0;
+    for (int i = 0; i < nclients; i++) {
+        clients[i].fd = bench_connect();
+        if (clients[i].fd == -1) {
+            perror("connect");
+            exit(1);
+        }
+        clients[i].pipeline = pipeline;
+        clients[i].rng = 0x9e3779b97f4a7c15ull * (i + 1);
+        pthread_create(&clients[i].tid, NULL, client_main, &clients[i]);
+    }
+
+    usleep(500000); // Warm up
+    long start = total_done(clients, nclients);
+    uint64_t t0 = now_ns();
+    usleep((useconds_t)(seconds * 1e6));
+    long done = total_done(clients, nclients) - start;
+    double rate = done / ((now_ns() - t0) / 1e9);
+
+    g_stop = 1;
+    for (int i = 0; i < nclients; i++) {
+        pthread_join(clients[i].tid, NULL);
+        close(clients[i].fd);
+    }
+    free(clients);
+    bench_server_stop(&srv);
+    return rate;
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 5;
+    int nclients = argc > 2 ? atoi(argv[2]) : 50;
+    int pipeline = argc > 3 ? atoi(argv[3]) : 16;
+    int io_mode = argc > 4 && strcmp(argv[4], "io-threads") == 0;
+    const char *option = io_mode ? "--io-threads" : "--threads";
+    static const char *const k_counts[] = {"1", "2", "4", "8"};
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("%d clients, pipeline %d, %.1fs per run, %ld CPUs\n", nclients, pipeline, seconds, ncpu);
+    printf("%12s %14s %8s\n", option + 2, "requests/s", "speedup");
+    fflush(stdout); // Before the server inherits the buffer
+    double base = 0;
+    for (size_t i = 0; i < sizeof(k_counts) / sizeof(k_counts[0]); i++) {
+        const char *args[] = {option, k_counts[i], NULL};
+        double rate = run(args, seconds, nclients, pipeline);
+        if (base == 0) base = rate;
+        printf("%12s %14.0f %7.2fx\n", k_counts[i], rate, rate / base);
+        fflush(stdout);
+    }
+    return 0;
+}
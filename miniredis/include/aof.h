@@ -6,7 +6,7 @@
 void aof_init(const char *filename);
 void aof_close(void);
 void aof_sync(void);
-void aof_log(int argc, char **argv); // Log a command
+void aof_log(int argc, const Slice *argv); // Log a command (binary-safe)
 void aof_load(void (*callback)(RedisCmd *cmd)); // Replay commands
 
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef MINIREDIS_COMMAND_H
+#define MINIREDIS_COMMAND_H
+
+#include <stddef.h> // size_t
+#include "conn.h"
+#include "resp.h"
+
+// Command flags
+#define CMD_WRITE    (1 << 0) // Modifies the keyspace (replayed from the AOF)
+#define CMD_READONLY (1 << 1) // Only reads the keyspace
+#define CMD_DENYOOM  (1 << 2) // May grow memory: refused while over maxmemory
+
+// Handler: conn is NULL while replaying the AOF (replies are discarded)
+typedef void (*command_proc)(struct connection *conn, RedisCmd *cmd);
+
+typedef struct RedisCommand {
+    const char *name;          // Lower-case command name
+    size_t namelen;            // Filled in by command_table_init
+    command_proc proc;
+    int arity;                 // argc must equal N, or be at least -N if negative
+    int flags;
+    // Per-command stats (updated atomically, see command_stat_add)
+    unsigned long long calls;
+    unsigned long long usec;   // Total time spent in proc
+    unsigned long long rejected_calls;
+} RedisCommand;
+
+// Builds the lookup table (a collision-free hash over the command names)
+void command_table_init(void);
+
+// Case-insensitive lookup, O(1): one hash and one compare. NULL if unknown.
+RedisCommand *command_lookup(const char *name, size_t len);
+
+// Returns non-zero if argc is acceptable for the command
+int command_check_arity(const RedisCommand *c, int argc);
+
+// Stats are bumped from every reactor thread
+static inline void command_stat_add(unsigned long long *stat, unsigned long long n) {
+    __atomic_fetch_add(stat, n, __ATOMIC_RELAXED);
+}
+
+// Appends the commandstats section of INFO to buf; returns bytes written
+size_t command_stats_info(char *buf, size_t size);
+
+#endif
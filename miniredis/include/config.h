@@ -0,0 +1,29 @@
+#ifndef MINIREDIS_CONFIG_H
+#define MINIREDIS_CONFIG_H
+
+#include <stddef.h> // size_t
+
+// Server settings, filled with defaults and overridden from the command line
+// (e.g. ./miniredis-server --port 6380 --obuf-hard-limit 64mb)
+struct server_config {
+    char port[16];
+    size_t obuf_hard_limit;   // Disconnect as soon as pending output exceeds this (0 = off)
+    size_t obuf_soft_limit;   // Disconnect if output stays above this ... (0 = off)
+    int obuf_soft_seconds;    // ... for this many seconds
+    size_t maxmemory;         // Keyspace memory limit (0 = off)
+    int maxmemory_policy;     // EVICT_* (see store.h)
+    int maxmemory_samples;    // Keys sampled per eviction
+    int threads;              // Reactor threads (1..CONFIG_MAX_THREADS)
+    int io_threads;           // Threads doing socket I/O per reactor, itself included (1 = off)
+};
+
+#define CONFIG_MAX_THREADS 64
+#define CONFIG_MAX_IO_THREADS 16
+
+// Parses "--name value" pairs. Returns 0 on success, -1 on a bad option.
+int config_load_args(int argc, char **argv);
+
+// Read-only access to the active configuration
+const struct server_config *config_get(void);
+
+#endif
@@ -1,12 +1,39 @@
 #ifndef MINIREDIS_CONN_H
 #define MINIREDIS_CONN_H
 
-#include <poll.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "resp.h"
 
 #define INITIAL_BUF_SIZE 1024
+#define MAX_QUERY_BUF_SIZE (512 * 1024 * 1024) // Clients past this are dropped
+#define MAX_WBUF_SIZE (16 * 1024)    // wbuf stops growing here, the rest goes to chunks
+#define REPLY_CHUNK_SIZE (16 * 1024) // Minimum size of an overflow reply chunk
+#define CONN_IOV_MAX 64              // iovecs handed to a single writev()
+#define REPLY_ZEROCOPY_MIN (4 * 1024) // Values this large are sent by reference, not copied
+#define REPLY_REF_TAIL 64            // Bytes after a referenced value (its CRLF, the next header)
+
+struct HNode;
+
+// Reply bytes that did not fit in wbuf, queued in order after it.
+// A chunk sends the value of a pinned store node by reference (writev()
+// reads it in place, no copy), if it has one, then the bytes in its own
+// buf. A reference chunk's buf is REPLY_REF_TAIL bytes: enough for the
+// value's CRLF and what small replies follow, without another chunk.
+struct reply_chunk {
+    struct reply_chunk *next;
+    const char *ref;    // The pinned node's value, or NULL
+    size_t ref_len;
+    size_t size;        // Capacity of buf
+    size_t used;        // Bytes queued in buf
+    struct HNode *pin;  // Released once the chunk has been written
+    char buf[];
+};
 
 // Structure to hold connection state
 struct connection {
@@ -14,17 +41,40 @@ struct connection {
     char *rbuf;
     size_t rbuf_size;
     size_t rbuf_used;
+    RespParser parser;               // Progress through the frame at the front of rbuf
     char *wbuf;
     size_t wbuf_size;
     size_t wbuf_used;
-    struct connection *next;
+    size_t wbuf_sent;                // Bytes of wbuf already written
+    struct reply_chunk *reply_head;  // Overflow chunks, flushed after wbuf
+    struct reply_chunk *reply_tail;
+    size_t reply_bytes;              // Unsent bytes queued in the chunk list
+    size_t reply_sent;               // Bytes of reply_head already written
+    int pending_write;               // Linked into the server's pending-writes list
+    int want_write;                  // EPOLLOUT armed: socket was full at last flush
+    int close_asap;                  // Output limit hit or out of memory: drop the client
+    time_t obuf_soft_since;          // When output first went over the soft limit (0 = under)
+    struct connection *next;         // Next connection in that list
+    int pending_read;                // Linked into the reactor's pending-reads list (I/O threads)
+    struct connection *next_read;
+    // Results of the last threaded read or write (see iothreads.h)
+    int io_status;
+    int io_worker;                   // Pool thread holding the parsed commands
+    size_t io_first;                 // Index of the first one there
+    size_t io_ncmds;
+    size_t io_parsed;                // Bytes of rbuf they cover
 };
 
-// Adds a file descriptor to the pollfd array
-void add_to_pfds(struct pollfd **pfds, int newfd, int *fd_count, int *fd_size);
+// Registers a connection with the epoll instance (edge-triggered).
+// The connection pointer is stored in the event data, so a wakeup hands
+// us the connection directly instead of an index into an fd array.
+int conn_watch(int epfd, struct connection *conn, uint32_t events);
 
-// Removes a file descriptor from the pollfd array
-void del_from_pfds(struct pollfd pfds[], int i, int *fd_count);
+// Changes the events a registered connection is watched for
+int conn_rewatch(int epfd, struct connection *conn, uint32_t events);
+
+// Removes a connection from the epoll instance
+void conn_unwatch(int epfd, struct connection *conn);
 
 // Creates a new connection object
 struct connection *conn_create(int fd);
@@ -32,4 +82,31 @@ struct connection *conn_create(int fd);
 // Frees a connection object
 void conn_free(struct connection *conn);
 
+// Makes room for at least `extra` more bytes (+1 for a NUL) in the read buffer
+int conn_reserve_rbuf(struct connection *conn, size_t extra);
+
+// Drops the first `n` bytes of the read buffer (already parsed frames)
+void conn_consume_rbuf(struct connection *conn, size_t n);
+
+// Queues reply bytes: into wbuf while it has room, then into reply chunks.
+// Returns -1 and sets close_asap if memory runs out; nothing more is
+// queued for the connection after that.
+int conn_add_reply(struct connection *conn, const char *data, size_t len);
+
+// Queues `len` bytes at `data` by reference. `node` owns the bytes and is
+// pinned until they are written, so overwriting the key meanwhile is safe.
+int conn_add_reply_ref(struct connection *conn, struct HNode *node,
+                       const char *data, size_t len);
+
+// Returns non-zero if the connection has unsent reply bytes
+int conn_has_pending_output(const struct connection *conn);
+
+// Bytes queued for the client but not yet written
+size_t conn_output_size(const struct connection *conn);
+
+// Writes queued replies with writev(), several buffers per syscall.
+// Returns 1 when everything was sent, 0 if the socket would block,
+// -1 on error.
+int conn_flush(struct connection *conn);
+
 #endif
@@ -0,0 +1,50 @@
+#ifndef MINIREDIS_EPOCH_H
+#define MINIREDIS_EPOCH_H
+
+#include <stddef.h> // NULL
+#include <stdint.h> // uint64_t
+
+// Epoch-based reclamation for lock-free readers.
+// A reader brackets its accesses with epoch_enter/epoch_exit. A writer
+// that unlinks an object stamps it with epoch_retire() afterwards, and may
+// free it once epoch_safe() has moved past the stamp: by then no reader
+// that could have seen the object is still inside its critical section.
+// Readers never wait; only freeing is delayed.
+
+#define EPOCH_MAX_THREADS 64
+
+typedef struct EpochSlot {
+    uint64_t active; // Epoch the thread entered at, 0 while outside
+    char pad[56];    // One slot per cache line
+} EpochSlot;
+
+extern __thread EpochSlot *epoch_self;
+extern uint64_t epoch_global;
+
+// Give the calling thread a slot. Returns -1 if all are taken.
+int epoch_register(void);
+
+static inline int epoch_registered(void) {
+    return epoch_self != NULL;
+}
+
+static inline void epoch_enter(void) {
+    __atomic_store_n(&epoch_self->active, __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE),
+                     __ATOMIC_SEQ_CST);
+    // Publish the slot before loading any shared pointer
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void epoch_exit(void) {
+    __atomic_store_n(&epoch_self->active, 0, __ATOMIC_RELEASE);
+}
+
+// Stamp for an object that was just unlinked (advances the epoch)
+static inline uint64_t epoch_retire(void) {
+    return __atomic_fetch_add(&epoch_global, 1, __ATOMIC_SEQ_CST);
+}
+
+// Objects stamped below this can no longer be reached by any reader
+uint64_t epoch_safe(void);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef MINIREDIS_IOTHREADS_H
+#define MINIREDIS_IOTHREADS_H
+
+#include <stddef.h> // size_t
+#include "conn.h"
+#include "resp.h"
+
+// Threaded I/O, as in Redis 6: commands still run on the reactor thread,
+// but recv() + parsing and writev() for a batch of ready clients are
+// spread over a small pool. Each round is a barrier: the reactor hands out
+// the connections, does its own share, and waits for the helpers, so a
+// connection is never touched by two threads at once.
+
+// Outcome of a threaded read, left in conn->io_status
+enum {
+    IO_READ_OK,     // Socket drained; complete commands parsed
+    IO_READ_MORE,   // Stopped after K_IO_READ_MAX bytes: read again soon
+    IO_READ_DEFER,  // A large bulk string is in flight: use the normal path
+    IO_READ_CLOSED, // Hung up, recv() failed or the query buffer is full
+    IO_READ_PROTO   // Protocol error after the parsed commands
+};
+
+typedef struct IOPool IOPool;
+
+// Starts nthreads - 1 helpers; the calling thread is the remaining one
+IOPool *io_pool_create(int nthreads);
+
+int io_pool_size(const IOPool *pool);
+
+// Reads and parses every connection. Results go to conn->io_*; the
+// commands point into rbuf and stay valid until it is next touched.
+void io_pool_read(IOPool *pool, struct connection **conns, size_t n);
+
+// Command i (< conn->io_ncmds) parsed by the last io_pool_read
+void io_pool_command(const IOPool *pool, const struct connection *conn, size_t i,
+                     RedisCmd *cmd);
+
+// Flushes every connection; conn_flush()'s result goes to conn->io_status
+void io_pool_write(IOPool *pool, struct connection **conns, size_t n);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef MINIREDIS_MEM_H
+#define MINIREDIS_MEM_H
+
+#include <stddef.h> // size_t
+
+// Allocation accounting.
+// Long-lived allocations go through these wrappers with a category, and
+// callers hand the size back on free/realloc (they always know it), so
+// tracking costs two additions per call: no size headers, no
+// malloc_usable_size(). Per-command buffers that grow with the request
+// count as client memory; fixed-size scratch memory is not counted.
+
+enum mem_category {
+    MEM_NODES,        // Nodes (malloc'd blocks or slab pages)
+    MEM_TABLES,       // Hash table arrays and the TTL index
+    MEM_ZSETS,        // Sorted set entries, skiplist nodes and member hashes
+    MEM_CLIENT_QUERY, // Read buffers, parser buffers and key hashes of clients
+    MEM_CLIENT_REPLY, // Write buffers, reply chunks and SCAN results of clients
+    MEM_CLIENT_OTHER, // Connection structs
+    MEM_NCATEGORIES
+};
+
+void *mem_malloc(size_t size, int cat);
+void *mem_calloc(size_t n, size_t size, int cat);
+void *mem_realloc(void *ptr, size_t old_size, size_t new_size, int cat);
+void mem_free(void *ptr, size_t size, int cat);
+// `size` bytes aligned to `align` (a power of two); freed with mem_free
+void *mem_aligned_alloc(size_t align, size_t size, int cat);
+
+// Give free heap memory back to the system (malloc_trim with glibc).
+// Walks the heap: call it now and then, not per free.
+void mem_trim(void);
+
+size_t mem_used(int cat);
+size_t mem_used_total(void);
+size_t mem_peak(void);
+
+// Resident set size from /proc (0 if unavailable). Not cheap: INFO only.
+size_t mem_rss(void);
+
+#endif
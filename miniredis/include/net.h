@@ -11,14 +11,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 
-// Opens a listening socket on the given port
-int get_listener_socket(const char *port);
+// Opens a listening socket on the given port. With `reuseport` set
+// (SO_REUSEPORT) it may be called once per thread for the same port;
+// without it, binding a port already in use fails.
+int get_listener_socket(const char *port, int reuseport);
 
 // Sets a socket to non-blocking mode
 int set_nonblocking(int fd);
 
-// Ensures all data in the buffer is sent
+// Turns off Nagle's algorithm: a reply flushed in several writev() calls
+// must not wait for the client's delayed ACK between them
+int set_nodelay(int fd);
+
+// Ensures all data in the buffer is sent (blocking helper; the server
+// itself queues replies per connection and flushes them with conn_flush)
 int sendall(int s, char *buf, int *len);
 
 // Helper to get IPv4 or IPv6 address
@@ -0,0 +1,33 @@
+#ifndef MINIREDIS_REPLY_H
+#define MINIREDIS_REPLY_H
+
+#include <stddef.h> // size_t
+#include "conn.h"
+#include "store.h"
+
+// RESP reply helpers.
+// Replies are queued on the connection and flushed with writev() once per
+// event-loop iteration. A NULL connection (AOF replay) discards the reply.
+
+// Send a simple string response (+OK\r\n)
+void send_simple_string(struct connection *conn, const char *msg);
+
+// Send an error response (-ERR ...\r\n)
+void send_error(struct connection *conn, const char *msg);
+
+// Send a bulk string response ($len\r\nstring\r\n), or a null bulk for NULL
+void send_bulk_string(struct connection *conn, const char *str);
+
+// Send a binary-safe bulk string of known length
+void send_bulk_slice(struct connection *conn, Slice s);
+
+// Send a stored value as a bulk string (large values by reference)
+void send_bulk_value(struct connection *conn, HNode *node);
+
+// Send an integer response (:num\r\n)
+void send_integer(struct connection *conn, long long val);
+
+// Send an array header (*n\r\n); the n elements are sent after it
+void send_array_len(struct connection *conn, long long n);
+
+#endif
@@ -2,13 +2,59 @@
 #define RESP_H
 
 #include <stddef.h> // size_t
+#include "slice.h"
 
+#define RESP_MAX_ARGS (1024 * 1024) // Upper bound on *N to reject garbage headers
+#define RESP_INLINE_ARGS 16         // Commands up to this many args need no allocation
+#define RESP_BIG_BULK (32 * 1024)   // Partial bulks this large get their own buffer
+#define RESP_MAX_BULK_LEN (512LL * 1024 * 1024)
+
+// A parsed command. argv[i] points straight into the buffer that was parsed
+// (no copies), so the command is only valid until that buffer changes.
+// Arguments are binary-safe slices: they may contain NUL bytes and are
+// not NUL-terminated. argv[0] is the command name.
 typedef struct RedisCmd {
     int argc;
-    char **argv;
-    char *name; // Shortcut to argv[0], no need to free separate
+    Slice *argv;
+    Slice argv_inline[RESP_INLINE_ARGS];
 } RedisCmd;
 
+// One argument of a frame being parsed
+typedef struct RespArg {
+    size_t off;  // Offset of the data from the frame start
+    size_t len;
+    char *own;   // Separate buffer for a large bulk string, or NULL
+} RespArg;
+
+// Resumable parser state, one per client stream (see resp.c)
+typedef struct RespParser {
+    int state;
+    int direct_ok;         // Large bulks may be read into their own buffer
+    long long argc;        // From the *N header
+    long long argi;        // Arguments completed so far
+    long long bulk_len;    // Announced length of the current bulk string
+    size_t pos;            // Parse position, relative to the frame start
+    RespArg *args;
+    RespArg args_inline[RESP_INLINE_ARGS];
+    char *big;             // Large bulk string being received
+    size_t big_used;
+} RespParser;
+
+void resp_parser_init(RespParser *p, int direct_ok);
+
+// Frees per-frame buffers and starts over. Call after executing a command.
+void resp_parser_reset(RespParser *p);
+
+// While a large bulk string is being received, returns where the next
+// bytes belong (and how many are still missing); NULL otherwise.
+char *resp_parser_bulk_dest(RespParser *p, size_t *room);
+void resp_parser_bulk_filled(RespParser *p, size_t n);
+
+int resp_parse(RespParser *p, char *buf, size_t *len, RedisCmd *cmd);
+
+// Selects the fastest CRLF scanner for this CPU (SSE2/AVX2/scalar)
+void resp_init(void);
+
 int parse_request(char *buf, size_t len, RedisCmd *cmd);
 void free_redis_cmd(RedisCmd *cmd);
 
@@ -4,4 +4,8 @@
 void server_init(const char *port);
 void server_run();
 
+// Replay the AOF opened by aof_init, then log keys the store expires or
+// evicts from now on as DEL
+void server_load_aof(void);
+
 #endif
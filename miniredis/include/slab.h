@@ -0,0 +1,93 @@
+#ifndef MINIREDIS_SLAB_H
+#define MINIREDIS_SLAB_H
+
+#include <stddef.h> // size_t
+
+// Size-class slab allocator for store nodes.
+// Memory is taken from the system in SLAB_PAGE_SIZE pages, each cut into
+// equal chunks of one size class. Freed chunks go back on their page's
+// free list and are handed out again before any new page is taken, so an
+// overwrite-heavy workload keeps reusing the same memory instead of
+// scattering holes across the malloc heap.
+// Pages are aligned to their size, so a chunk finds its page header by
+// masking its address. A page whose chunks are all free goes back to
+// malloc, unless it is the last page of its class with room (so a class
+// hovering around a page boundary does not allocate and free one page per
+// operation).
+// Blocks larger than SLAB_MAX_CHUNK fall through to malloc.
+//
+// Pages are optional (slab_init's `paged`): without them every block is
+// malloc'd and the slab only keeps the counters. That is the store's
+// default. On an overwrite-heavy mix of value sizes, pages end up holding
+// more memory per live byte than glibc does (class rounding, chunks
+// stranded on pages kept alive by a few live ones, and posix_memalign
+// slack); bench/alloc_replay measures both.
+
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_MIN_CHUNK 48            // Smallest class (a node with short key and value)
+#define SLAB_MAX_CHUNK 4096          // Largest class; bigger blocks use malloc
+#define SLAB_ALIGN 16                // Chunk sizes are multiples of this
+#define SLAB_MAX_CLASSES 64
+
+// Built with -DSLAB_POISON (tests/test_lockfree), freed blocks are filled
+// with this byte first, so a read of freed memory can't pass for a node
+#define SLAB_POISON_BYTE 0xdd
+
+// Header at the start of every page; the chunks follow it
+typedef struct SlabPage {
+    struct SlabPage *prev;   // In the class's list of pages with free chunks
+    struct SlabPage *next;
+    void *free_list;         // Freed chunks (the link lives in the chunk itself)
+    char *fresh;             // Uncut remainder of the page
+    unsigned fresh_left;     // Chunks left at fresh
+    unsigned used;           // Chunks handed out
+    unsigned cls;            // Index of its size class
+} SlabPage;
+
+typedef struct SlabClass {
+    size_t size;       // Chunk size
+    SlabPage *partial; // Pages with free chunks, the one allocated from first
+    size_t pages;      // Pages owned by this class
+    size_t used;       // Chunks handed out
+} SlabClass;
+
+typedef struct Slab {
+    SlabClass classes[SLAB_MAX_CLASSES];
+    int nclasses;
+    unsigned char class_of[SLAB_MAX_CHUNK / SLAB_ALIGN + 1]; // Size (in SLAB_ALIGN units) -> class
+    size_t used_bytes;   // Chunks handed out, kept current for cheap polling
+    size_t large_bytes;  // Live blocks served by malloc
+    size_t large_count;
+    size_t pages_released; // Empty pages given back to malloc so far
+    int paged;           // Small blocks come from pages (else everything is malloc'd)
+} Slab;
+
+// Allocator statistics (see slab_get_stats)
+typedef struct SlabStats {
+    size_t page_bytes;   // Memory held in pages
+    size_t used_bytes;   // Chunks currently handed out
+    size_t free_bytes;   // Free chunks and page headers
+    size_t large_bytes;  // Blocks served by malloc
+    double frag_ratio;   // page_bytes / used_bytes (1.0 = no waste)
+} SlabStats;
+
+void slab_init(Slab *slab, int paged);
+
+// The size a request of `size` bytes really gets: the chunk size of its
+// class, or `size` rounded to SLAB_ALIGN for a malloc'd block. Callers may
+// use the whole block, and must pass this size back to slab_free.
+size_t slab_block_size(const Slab *slab, size_t size);
+
+void *slab_alloc(Slab *slab, size_t size);
+void slab_free(Slab *slab, void *ptr, size_t size);
+
+void slab_get_stats(const Slab *slab, SlabStats *st);
+
+// Add the counters of `from` to `into` (both set up by slab_init), so
+// several slabs can be reported as one. Only the statistics are merged.
+void slab_merge_stats(Slab *into, const Slab *from);
+
+// "# Allocator" INFO section. Returns the length written.
+size_t slab_stats_info(const Slab *slab, char *buf, size_t size);
+
+#endif
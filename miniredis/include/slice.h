@@ -0,0 +1,49 @@
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // int64_t
+#include <string.h> // strlen
+
+// Binary-safe string: a pointer plus an explicit length.
+// The bytes are borrowed (not owned) and need not be NUL-terminated, so
+// keys and values may hold any byte, '\0' included, and the length is
+// carried along instead of being recomputed with strlen().
+typedef struct Slice {
+    const char *ptr;
+    size_t len;
+} Slice;
+
+// Wrap a C string (literals, config values)
+static inline Slice slice_cstr(const char *s) {
+    return (Slice){s, strlen(s)};
+}
+
+// Parse a canonical decimal integer: what int64_to_chars would print for
+// some value (no sign '+', no leading zeros, no spaces, fits in int64).
+// Returns 1 and sets *out on success, 0 otherwise.
+int slice_to_int64(Slice s, int64_t *out);
+
+#define INT64_STR_MAX 21 // "-9223372036854775808" plus room for a NUL
+
+// Format v into buf (at least INT64_STR_MAX bytes, not NUL-terminated).
+// Returns the length.
+size_t int64_to_chars(int64_t v, char *buf);
+
+// Parse a float (sorted set scores): anything strtod takes in full,
+// "inf" and "-inf" included, but not NaN or surrounding spaces.
+// Returns 1 and sets *out on success, 0 otherwise.
+int slice_to_double(Slice s, double *out);
+
+#define DOUBLE_STR_MAX 32 // "%.17g" of any double, with room to spare
+
+// Format v into buf (at least DOUBLE_STR_MAX bytes, not NUL-terminated)
+// with the fewest digits that parse back to v. Returns the length.
+size_t double_to_chars(double v, char *buf);
+
+// Glob-style match, as in Redis KEYS/SCAN MATCH: '*' any run of bytes,
+// '?' any one byte, [abc] / [^abc] / [a-z] classes, '\' escapes.
+// Returns 1 if the whole of s matches.
+int slice_glob_match(Slice pattern, Slice s);
+
+#endif
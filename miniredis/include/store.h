@@ -2,32 +2,312 @@
 #define STORE_H
 
 #include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <string.h> // memcpy
+#include "slice.h"
+#include "slab.h"
 
 // Node Structure (Linked List)
+// One allocation holds the node, the key and the value:
+//   [ header | key \0 | value \0 (+ spare room up to vcap) ]
+// so a lookup touches one block and a SET costs one malloc.
+// klen/vlen are authoritative: keys and values are binary-safe and the
+// trailing '\0' is only a convenience.
 typedef struct HNode {
     struct HNode *next;
-    uint64_t hcode; // Hash code stored for resizing
-    char *key;
-    char *value;
+    uint64_t hcode;   // Hash code stored for resizing
+    int refcount;     // 1 for the table + 1 per reply still pointing at value (atomic)
+    uint32_t klen;    // Key length
+    uint32_t vlen;    // Value length
+    uint32_t vcap;    // Bytes available for the value (overwrite in place if it fits)
+    uint32_t encoding : 8; // HNODE_ENC_*
+    uint32_t lru : 24;     // Access clock (LRU) or counter + decay time (LFU), see store.c
+    uint32_t vidx;    // 1 + position in HMap.expires, or 0 if the key never expires
+    char data[];      // Key, then value, each NUL-terminated
 } HNode;
 
-// Table Structure (Dictionary)
-typedef struct HMap {
-    HNode **tab;   // Array of pointers (Main table)
+// Value encodings
+#define HNODE_ENC_RAW 0 // vlen bytes at hnode_value()
+#define HNODE_ENC_INT 1 // An int64 at hnode_value() (vlen == 8), formatted only when read
+#define HNODE_ENC_ZSET 2 // A ZSet pointer at hnode_value() (vlen == sizeof(ZSet *))
+
+static inline char *hnode_key(HNode *node) { return node->data; }
+static inline char *hnode_value(HNode *node) { return node->data + node->klen + 1; }
+
+// Value of an HNODE_ENC_INT node (the value area need not be aligned)
+static inline int64_t hnode_int(HNode *node) {
+    int64_t v;
+    memcpy(&v, hnode_value(node), sizeof(v));
+    return v;
+}
+static inline Slice hnode_key_slice(HNode *node) { return (Slice){node->data, node->klen}; }
+
+// Sorted set of an HNODE_ENC_ZSET node
+struct ZSet;
+static inline struct ZSet *hnode_zset(HNode *node) {
+    struct ZSet *zs;
+    memcpy(&zs, hnode_value(node), sizeof(zs));
+    return zs;
+}
+
+// Table Structure. The engine is picked at build time:
+// chained (default) or Swiss-table open addressing (make HASH_ENGINE=swiss).
+#ifndef HMAP_SWISS
+// One array of chains
+typedef struct HTab {
+    HNode **tab;   // Array of pointers
     size_t mask;   // Table size - 1 (Used for index masking)
     size_t size;   // Total slots (Must be Power of 2)
     size_t used;   // Number of actual data items
+} HTab;
+#else
+// Open addressing: node pointers plus one control byte per slot,
+// probed 16 slots at a time (HNode.next is unused)
+typedef struct HTab {
+    uint8_t *ctrl;     // EMPTY, DELETED or the 7-bit hash tag of each slot
+    HNode **slots;
+    size_t mask;       // Table size - 1
+    size_t size;       // Total slots (Power of 2, at least 16)
+    size_t used;       // Number of actual data items
+    size_t tombstones; // DELETED slots (count towards the load factor)
+} HTab;
+#endif
+
+// A key with a TTL: expiry time in unix milliseconds
+typedef struct HExpire {
+    HNode *node;
+    int64_t when;
+} HExpire;
+
+// Memory unlinked while lock-free readers may still hold it: a node
+// (bytes == 0; its table reference is dropped) or a table array
+typedef struct HRetired {
+    void *ptr;
+    size_t bytes;
+    uint64_t epoch; // Stamp from epoch_retire()
+} HRetired;
+
+// Dictionary: two tables for incremental rehashing.
+// When `newer` fills up it becomes `older` and a table twice the size
+// takes its place; the nodes then move over a few buckets at a time.
+// Keys with a TTL are also listed in `expires` (unordered, so the active
+// expiry cycle can sample it at random in O(1)).
+// Each map allocates its nodes from its own slab; a map is not
+// thread-safe by itself (the global store locks one per shard), except
+// for hmap_lookup_lockfree once lock-free reads are switched on.
+typedef struct HMap {
+    HTab newer;          // Inserts always go here
+    HTab older;          // Being drained while rehashing (size == 0 otherwise)
+    size_t migrate_pos;  // Next bucket of `older` to move
+    HExpire *expires;
+    size_t nexpires;
+    size_t expires_cap;
+    uint64_t expired_keys; // Keys removed because their TTL ran out
+    uint64_t evicted_keys; // Keys removed to stay under maxmemory
+    Slab slab;             // Node memory
+    size_t payload_bytes;  // Key and value bytes of all live nodes
+    // Lock-free reads (chained engine only)
+    int lockfree_reads;    // Nodes are never changed in place, frees are deferred
+    uint64_t seq;          // Odd while nodes move between chains or tables change
+    HRetired *retired;     // Waiting for readers to move on
+    size_t nretired;
+    size_t retired_cap;
+    size_t retire_next;    // Try to reclaim when nretired reaches this
 } HMap;
 
 // API
 void hmap_init(HMap *hmap);
 void hmap_destroy(HMap *hmap);
-HNode *hmap_lookup(HMap *hmap, const char *key);
-void hmap_insert(HMap *hmap, const char *key, const char *value);
-int hmap_delete(HMap *hmap, const char *key);
+HNode *hmap_lookup(HMap *hmap, Slice key);
+int hmap_insert(HMap *hmap, Slice key, Slice value); // HMAP_OK or HMAP_ERR_OOM
+int hmap_delete(HMap *hmap, Slice key);
+
+// Batched access for multi-key commands: hash every key once, prefetch
+// all their buckets, then all the nodes in them, and only then probe, so
+// the cache misses of the whole batch overlap instead of queueing.
+// The *_hashed calls take the hmap_hash of the key.
+uint64_t hmap_hash(Slice key);
+void hmap_prefetch(HMap *hmap, uint64_t h);      // The key's bucket
+void hmap_prefetch_node(HMap *hmap, uint64_t h); // First node in it (bucket prefetched first)
+HNode *hmap_lookup_hashed(HMap *hmap, Slice key, uint64_t h);
+int hmap_insert_hashed(HMap *hmap, Slice key, uint64_t h, Slice value);
+int hmap_delete_hashed(HMap *hmap, Slice key, uint64_t h);
+
+// INCRBY: add delta to the integer stored at key (a missing key counts as
+// 0) and report the new value. Values are kept int-encoded, so a counter
+// is updated in place without formatting or allocating.
+#define HMAP_OK 0
+#define HMAP_ERR_NOT_INT -1  // Current value is not an integer
+#define HMAP_ERR_OVERFLOW -2 // Result would not fit in int64
+#define HMAP_ERR_WRONGTYPE -3 // The key holds a sorted set
+#define HMAP_ERR_OOM -4      // No memory for the new value (the key is unchanged)
+int hmap_incrby(HMap *hmap, Slice key, int64_t delta, int64_t *result);
+
+// Sorted sets. A set node is never overwritten in place (SET swaps in a
+// fresh node), so even a lock-free reader can tell it from a string; the
+// set itself is only changed with the shard locked.
+// Returns the set at key, or NULL if the key is missing (an empty set is
+// created instead with `create`, NULL then meaning out of memory) or holds
+// a string (*wrongtype is set).
+struct ZSet *hmap_zset(HMap *hmap, Slice key, int create, int *wrongtype);
+
+// Key expiry. Times are absolute unix milliseconds. An expired key is
+// removed as soon as any command touches it (lazy expiry) or when the
+// active cycle samples it, whichever comes first. SET clears a key's TTL;
+// INCR and friends keep it.
+int64_t store_mstime(void);
+int hmap_set_expire(HMap *hmap, Slice key, int64_t when); // 0 if the key does not exist
+int hmap_persist(HMap *hmap, Slice key);                  // 1 if a TTL was removed
+#define HMAP_NO_KEY -2
+#define HMAP_NO_TTL -1
+int64_t hmap_get_expire(HMap *hmap, Slice key); // Expiry time, HMAP_NO_KEY or HMAP_NO_TTL
+
+// While loading the AOF nothing expires: a TTL already in the past is kept
+// as is, and the key goes once loading is over, by lazy or active expiry.
+// Deleting it during the replay would let a later INCR or ZADD in the log
+// recreate it without a TTL.
+void store_set_loading(int loading);
+
+// Called, with the shard locked, for each key the store removes by itself
+// (expired or evicted) just before it goes, so the AOF can record a DEL
+typedef void (*store_removed_fn)(Slice key);
+void store_set_removed_hook(store_removed_fn fn);
+
+// Bytes attributable to one key (node, table slot, TTL entry, sorted set), or -1
+int64_t hmap_memory_usage(HMap *hmap, Slice key);
+
+// Fill `out` with up to n keys picked from a random spot in the table.
+// Returns how many were found.
+size_t hmap_sample(HMap *hmap, HNode **out, size_t n);
+
+// SCAN: visit the live keys in the bucket(s) at `cursor` and return the
+// next cursor, 0 once the whole table was covered. Every key present for
+// the whole scan is reported at least once, even across resizes; some
+// may be reported twice. fn must not change the map. Adds the number of
+// keys visited to *found.
+typedef void (*hmap_scan_fn)(HNode *node, void *arg);
+uint64_t hmap_scan(HMap *hmap, uint64_t cursor, hmap_scan_fn fn, void *arg, size_t *found);
+
+// Active expiry: sample keys with a TTL and delete the expired ones, for
+// as long as samples keep finding plenty of them and the time budget
+// allows. Returns the number of keys removed.
+size_t hmap_expire_cycle(HMap *hmap, long long budget_us);
+size_t hmap_size(HMap *hmap);
+
+// Incremental rehashing: move up to `nbuckets` buckets from the old table.
+// Returns non-zero while there is still work left.
+int hmap_rehash(HMap *hmap, size_t nbuckets);
+int hmap_is_rehashing(HMap *hmap);
+
+// Lock-free reads. Once on (before other threads use the map), writers
+// still take the lock, but publish every change with atomic stores, never
+// modify a node in place, and retire unlinked nodes and tables instead of
+// freeing them; readers then need no lock at all. Returns 0 if the engine
+// does not support it.
+int hmap_set_lockfree_reads(HMap *hmap);
+
+// Look a key up without the lock, between epoch_enter and epoch_exit
+// (the node stays valid until epoch_exit; pin it to keep it longer).
+// Returns 1 with *node set (NULL if missing), or 0 if the caller must
+// use the locked path: a resize moved nodes under us, or the key has a
+// TTL (lazy expiry needs the lock).
+int hmap_lookup_lockfree(HMap *hmap, Slice key, HNode **node);
+
+// Free what readers can no longer reach. Needs the lock.
+void hmap_reclaim(HMap *hmap);
+
+// Node pinning: a pinned node's value stays valid even if the key is
+// overwritten or deleted meanwhile (used by zero-copy replies).
+// Retain either with the node's shard locked, or between epoch_enter and
+// epoch_exit on a node from hmap_lookup_lockfree (GET does this): a node
+// unlinked while readers may see it keeps the table's reference on the
+// retired list until the epoch has moved past every such reader, so the
+// count is still at least 1 when the reader adds its own. Release from
+// any thread, without holding a shard lock (the last release locks the
+// shard to free it).
+void hnode_retain(HNode *node);
+void hnode_release(HNode *node);
+
+// --- Global Store ---
+// The keyspace is split into STORE_SHARDS maps by the top bits of the key
+// hash, each behind its own mutex, so reactor threads working on
+// different keys rarely wait for each other.
+#define STORE_SHARD_BITS 4
+#define STORE_SHARDS (1 << STORE_SHARD_BITS)
 
-// Global Store API
 void store_init(void);
-HMap *store_get_db(void);
+
+// Lock the shard holding `key` and return its map. Everything done to
+// the map (and the AOF record of it) happens before store_unlock, so
+// writes to one key reach the log in the order they were applied.
+HMap *store_lock(Slice key);
+void store_unlock(HMap *map);
+
+// Multi-key commands: lock the shards of all the keys (by hmap_hash) and
+// return that set; the map of each key is then store_map(hash).
+uint32_t store_lock_many(const uint64_t *hashes, size_t n);
+void store_unlock_many(uint32_t shards);
+HMap *store_map(uint64_t h);
+
+// Switch every shard to lock-free reads, when running more than one
+// thread. Not done for LRU/LFU eviction, which records every read in the
+// node. Returns 1 if on.
+int store_enable_lockfree_reads(void);
+
+// Each thread that calls store_lookup_lockfree registers once
+void store_thread_init(void);
+
+// GET without the shard lock, between store_read_begin/store_read_end.
+// Same contract as hmap_lookup_lockfree.
+void store_read_begin(void);
+void store_read_end(void);
+int store_lookup_lockfree(Slice key, HNode **node);
+
+// Background work split between `nparts` callers: caller `part` handles
+// shards part, part + nparts, ...
+// Active expiry within the time budget; returns the keys removed.
+size_t store_expire_cycle(int part, int nparts, long long budget_us);
+// Incremental rehashing within the time budget; non-zero while work is left.
+int store_rehash(int part, int nparts, long long budget_us);
+// Free retired nodes and tables readers are done with
+void store_reclaim(int part, int nparts);
+
+// SCAN over every shard, one shard at a time (the cursor's low
+// STORE_SHARD_BITS hold the shard). Stops after about `count` keys, or
+// count * 10 buckets, whichever comes first. Returns the next cursor,
+// 0 when done. fn runs with the shard locked.
+uint64_t store_scan(uint64_t cursor, size_t count, hmap_scan_fn fn, void *arg);
+
+// --- Memory Limit ---
+// Eviction policies (maxmemory-policy)
+#define EVICT_NOEVICTION   0 // Refuse writes that need memory
+#define EVICT_ALLKEYS_LRU  1 // Evict the least recently used key
+#define EVICT_ALLKEYS_LFU  2 // Evict the least frequently used key
+#define EVICT_VOLATILE_TTL 3 // Evict the key with a TTL that expires soonest
+
+void store_set_maxmemory(size_t maxmemory, int policy, int samples);
+
+// Memory held by the keyspace: nodes, tables, the TTL index and sorted sets
+size_t store_used_memory(void);
+
+// Evict keys until used memory is under maxmemory.
+// Returns 0 when under the limit (or there is none), -1 if nothing more
+// can be evicted.
+int store_evict(void);
+
+// Advance the LRU/LFU clock (called from one thread's cron)
+void store_tick(void);
+// Set that clock to `ms` (unix milliseconds) instead of the current time,
+// for replaying an access trace in simulated time
+void store_set_clock(int64_t ms);
+
+// Node allocator statistics for INFO. Returns the length written.
+size_t store_alloc_info(char *buf, size_t size);
+
+// Key counts for INFO. Returns the length written.
+size_t store_keyspace_info(char *buf, size_t size);
+
+// Memory breakdown for INFO. Returns the length written.
+size_t store_memory_info(char *buf, size_t size);
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef MINIREDIS_ZSET_H
+#define MINIREDIS_ZSET_H
+
+#include <stddef.h> // size_t
+#include "slice.h"
+
+// Sorted set: members ordered by score, ties broken by the member bytes.
+// Small sets are one flat array of entries kept in order (compact
+// encoding): with a hundred or so members a linear scan beats any index.
+// Past ZSET_COMPACT_MAX_ENTRIES members, or once a member is longer than
+// ZSET_COMPACT_MAX_MEMBER bytes, the set turns into a skiplist whose
+// links record how many members they skip (rank and range queries in
+// O(log n + k)) plus a hash from member to skiplist node (O(1) score
+// lookups). It never turns back.
+// A set is owned by one store node and only touched under its shard lock.
+
+#define ZSET_COMPACT_MAX_ENTRIES 128
+#define ZSET_COMPACT_MAX_MEMBER 64
+
+typedef struct ZSet ZSet;
+
+ZSet *zset_new(void); // NULL if out of memory
+void zset_free(ZSet *zs);
+size_t zset_card(const ZSet *zs);
+size_t zset_bytes(const ZSet *zs); // Memory held (MEMORY USAGE)
+
+// zset_add flags (ZADD options)
+#define ZADD_NX (1 << 0) // Only add new members
+#define ZADD_XX (1 << 1) // Only update existing members
+#define ZADD_GT (1 << 2) // Only update to a greater score
+#define ZADD_LT (1 << 3) // Only update to a lower score
+
+// zset_add outcomes
+#define ZADD_NOP 0
+#define ZADD_ADDED 1
+#define ZADD_UPDATED 2
+#define ZADD_OOM -1
+
+int zset_add(ZSet *zs, double score, Slice member, int flags);
+int zset_remove(ZSet *zs, Slice member); // 1 if it was there
+int zset_score(const ZSet *zs, Slice member, double *score); // 1 if present
+
+// 0-based position in ascending order, or -1 if not a member
+long long zset_rank(const ZSet *zs, Slice member);
+
+// Members at ranks start..stop (0 <= start <= stop < card), in ascending
+// order, or counted from the highest score down with `rev`
+typedef void (*zset_range_fn)(Slice member, double score, void *arg);
+void zset_range(const ZSet *zs, size_t start, size_t stop, int rev,
+                zset_range_fn fn, void *arg);
+
+// Score interval; an exclusive end is written "(1.5" in commands
+typedef struct ZScoreRange {
+    double min, max;
+    int minex, maxex;
+} ZScoreRange;
+
+// Ranks of the first and last member in the interval.
+// Returns 0 if no member falls in it.
+int zset_score_ranks(const ZSet *zs, const ZScoreRange *range, size_t *first, size_t *last);
+
+#endif
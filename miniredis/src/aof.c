@@ -2,10 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "aof.h"
 #include "resp.h"
 
 static FILE *aof_fp = NULL;
+static int aof_loading = 0; // Replaying: commands being re-run must not be logged again
+static pthread_mutex_t aof_lock = PTHREAD_MUTEX_INITIALIZER; // One record at a time
 
 void aof_init(const char *filename) {
     aof_fp = fopen(filename, "a+"); // Append + Read
@@ -23,21 +26,25 @@ void aof_close(void) {
 }
 
 // Write generic command to AOF
-void aof_log(int argc, char **argv) {
-    if (!aof_fp) return;
+void aof_log(int argc, const Slice *argv) {
+    if (!aof_fp || aof_loading) return;
 
+    pthread_mutex_lock(&aof_lock);
     // Format: *argc\r\n
     fprintf(aof_fp, "*%d\r\n", argc);
     for (int i = 0; i < argc; i++) {
-        // $len\r\ncontent\r\n
-        fprintf(aof_fp, "$%zu\r\n%s\r\n", strlen(argv[i]), argv[i]);
+        // $len\r\ncontent\r\n (content written raw: it may contain NULs)
+        fprintf(aof_fp, "$%zu\r\n", argv[i].len);
+        fwrite(argv[i].ptr, 1, argv[i].len, aof_fp);
+        fwrite("\r\n", 1, 2, aof_fp);
     }
     // Flush to ensure it's written (or rely on OS buffering, but safely fsync is better)
     fflush(aof_fp);
+    pthread_mutex_unlock(&aof_lock);
 }
 
 void aof_sync(void) {
-    if (aof_fp) {
+    if (aof_fp && !aof_loading) {
         fsync(fileno(aof_fp));
     }
 }
@@ -70,29 +77,26 @@ void aof_load(void (*callback)(RedisCmd *cmd)) {
     char *ptr = buf;
     char *end = buf + fsize;
 
+    aof_loading = 1;
     while (ptr < end) {
         RedisCmd cmd;
-        int err = parse_request(ptr, end - ptr, &cmd);
-        if (err == 0) {
-            // Calculate how many bytes were consumed.
-            // parse_request doesn't return consumed bytes...
-            // Wait, parse_request returns 0 on success but doesn't tell us how much it read.
-            // This is a flaw in the current `parse_request` implementation for streaming/multiple commands.
-            // We need to fix `parse_request` to return bytes consumed or pointer.
-            
-            // For now, let's assume `parse_request` works but we can't easily advance `ptr`.
-            // Modifying `parse_request` is needed.
-            
-            callback(&cmd);
-            free_redis_cmd(&cmd);
-            
-             // Hack: we need to find the end of this command to advance `ptr`.
-             // Re-parsing logic or modifying `resp.c` is best.
-             break; // STOPPING HERE because we can't properly iterate without modifying resp.c
-        } else {
-            break; 
+        // parse_request returns the number of bytes consumed, so we can
+        // walk the log frame by frame.
+        int consumed = parse_request(ptr, end - ptr, &cmd);
+        if (consumed <= 0) {
+            if (consumed == 0) {
+                fprintf(stderr, "[AOF] Truncated command at end of log, ignoring\n");
+            } else {
+                fprintf(stderr, "[AOF] Bad command in log at offset %ld\n", (long)(ptr - buf));
+            }
+            break;
         }
+
+        callback(&cmd);
+        free_redis_cmd(&cmd);
+        ptr += consumed;
     }
+    aof_loading = 0;
     
     free(buf);
 }
\ No newline at end of file
@@ -0,0 +1,936 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // for strncasecmp
+#include "command.h"
+#include "reply.h"
+#include "store.h"
+#include "aof.h"
+#include "zset.h"
+#include "mem.h"
+
+// --- Command Implementations ---
+// Arity is checked by the dispatcher before a handler runs.
+// Handlers hold the key's shard lock while they touch the map and log the
+// change, so the AOF sees writes to a key in the order they happened;
+// the fsync and the reply come after the lock is dropped.
+
+#define K_ERR_WRONGTYPE "WRONGTYPE Operation against a key holding the wrong kind of value"
+
+// SET key value
+static void set_command(struct connection *conn, RedisCmd *cmd) {
+    // 1. Apply to in-memory database
+    HMap *db = store_lock(cmd->argv[1]);
+    if (hmap_insert(db, cmd->argv[1], cmd->argv[2]) != HMAP_OK) {
+        store_unlock(db);
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+
+    // 2. Persist to Disk (AOF); both are no-ops while replaying the log
+    aof_log(cmd->argc, cmd->argv);
+    store_unlock(db);
+    aof_sync(); // Force fsync to ensure durability
+
+    // 3. Send response to client
+    send_simple_string(conn, "OK");
+}
+
+// A string value, nil for a missing key, or WRONGTYPE for a sorted set
+static void send_string_value(struct connection *conn, HNode *node) {
+    if (!node) {
+        send_bulk_string(conn, NULL);
+    } else if (node->encoding == HNODE_ENC_ZSET) {
+        send_error(conn, K_ERR_WRONGTYPE);
+    } else {
+        send_bulk_value(conn, node); // Copies or pins the value
+    }
+}
+
+// GET key
+static void get_command(struct connection *conn, RedisCmd *cmd) {
+    HNode *node;
+
+    // Most reads need no lock: the node stays valid until store_read_end
+    store_read_begin();
+    if (store_lookup_lockfree(cmd->argv[1], &node)) {
+        send_string_value(conn, node);
+        store_read_end();
+        return;
+    }
+    store_read_end();
+
+    HMap *db = store_lock(cmd->argv[1]);
+    send_string_value(conn, hmap_lookup(db, cmd->argv[1]));
+    store_unlock(db);
+}
+
+// --- Multi-key Commands ---
+// The keys are hashed up front and their shards locked together (in
+// index order, see store_lock_many); buckets and nodes are prefetched for
+// the whole batch before the first probe.
+
+#define K_KEYS_INLINE 128 // Hashes kept on the stack; more go to the heap
+
+// Keys argv[first], argv[first + step], ... of a command
+typedef struct KeyBatch {
+    const Slice *argv;
+    int first;
+    int step;
+    size_t n;
+    uint64_t *hashes;
+    uint32_t shards; // Locked by keys_lock
+    uint64_t inline_hashes[K_KEYS_INLINE];
+} KeyBatch;
+
+static inline Slice batch_key(const KeyBatch *kb, size_t i) {
+    return kb->argv[kb->first + i * kb->step];
+}
+
+static inline HMap *batch_map(const KeyBatch *kb, size_t i) {
+    return store_map(kb->hashes[i]);
+}
+
+// Returns -1 (nothing locked) if the hashes don't fit in memory
+static int keys_lock(KeyBatch *kb, RedisCmd *cmd, int first, int step) {
+    kb->argv = cmd->argv;
+    kb->first = first;
+    kb->step = step;
+    kb->n = (size_t)(cmd->argc - first) / step;
+    kb->hashes = kb->inline_hashes;
+    if (kb->n > K_KEYS_INLINE) {
+        kb->hashes = mem_malloc(kb->n * sizeof(uint64_t), MEM_CLIENT_QUERY);
+        if (!kb->hashes) return -1;
+    }
+
+    for (size_t i = 0; i < kb->n; i++) kb->hashes[i] = hmap_hash(batch_key(kb, i));
+    kb->shards = store_lock_many(kb->hashes, kb->n);
+
+    // Buckets first; by the time the second pass reads them most have arrived
+    for (size_t i = 0; i < kb->n; i++) hmap_prefetch(batch_map(kb, i), kb->hashes[i]);
+    for (size_t i = 0; i < kb->n; i++) hmap_prefetch_node(batch_map(kb, i), kb->hashes[i]);
+    return 0;
+}
+
+static void keys_unlock(KeyBatch *kb) {
+    store_unlock_many(kb->shards);
+    if (kb->hashes != kb->inline_hashes) {
+        mem_free(kb->hashes, kb->n * sizeof(uint64_t), MEM_CLIENT_QUERY);
+    }
+}
+
+// MGET key [key ...]
+static void mget_command(struct connection *conn, RedisCmd *cmd) {
+    KeyBatch kb;
+    if (keys_lock(&kb, cmd, 1, 1) == -1) {
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+    send_array_len(conn, (long long)kb.n);
+    for (size_t i = 0; i < kb.n; i++) {
+        HNode *node = hmap_lookup_hashed(batch_map(&kb, i), batch_key(&kb, i), kb.hashes[i]);
+        if (node && node->encoding != HNODE_ENC_ZSET) { // Sorted sets read as nil
+            send_bulk_value(conn, node); // Copies or pins the value while locked
+        } else {
+            send_bulk_string(conn, NULL);
+        }
+    }
+    keys_unlock(&kb);
+}
+
+// Shared by MSET and MSETNX (which sets nothing if any key exists).
+// The whole command is one AOF record.
+static void mset_generic(struct connection *conn, RedisCmd *cmd, int nx) {
+    if (cmd->argc % 2 == 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "ERR wrong number of arguments for '%s' command",
+                 nx ? "msetnx" : "mset");
+        send_error(conn, msg);
+        return;
+    }
+
+    KeyBatch kb;
+    if (keys_lock(&kb, cmd, 1, 2) == -1) {
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+
+    int set = 1;
+    for (size_t i = 0; nx && i < kb.n; i++) {
+        if (hmap_lookup_hashed(batch_map(&kb, i), batch_key(&kb, i), kb.hashes[i])) set = 0;
+    }
+    size_t applied = 0;
+    if (set) {
+        while (applied < kb.n &&
+               hmap_insert_hashed(batch_map(&kb, applied), batch_key(&kb, applied),
+                                  kb.hashes[applied], cmd->argv[2 + 2 * applied]) == HMAP_OK) {
+            applied++;
+        }
+        // Logged as MSET: the replay must not depend on which keys exist then.
+        // Out of memory part way, only the pairs that were set are logged.
+        Slice name = cmd->argv[0];
+        cmd->argv[0] = slice_cstr("MSET");
+        if (applied) aof_log(1 + 2 * (int)applied, cmd->argv);
+        cmd->argv[0] = name;
+    }
+    keys_unlock(&kb);
+    if (applied) aof_sync();
+
+    if (set && applied < kb.n) {
+        send_error(conn, "ERR out of memory");
+    } else if (nx) {
+        send_integer(conn, set);
+    } else {
+        send_simple_string(conn, "OK");
+    }
+}
+
+// MSET key value [key value ...]
+static void mset_command(struct connection *conn, RedisCmd *cmd) {
+    mset_generic(conn, cmd, 0);
+}
+
+// MSETNX key value [key value ...]
+static void msetnx_command(struct connection *conn, RedisCmd *cmd) {
+    mset_generic(conn, cmd, 1);
+}
+
+// DEL key [key ...]
+static void del_command(struct connection *conn, RedisCmd *cmd) {
+    KeyBatch kb;
+    if (keys_lock(&kb, cmd, 1, 1) == -1) {
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+    long long deleted = 0;
+    for (size_t i = 0; i < kb.n; i++) {
+        deleted += hmap_delete_hashed(batch_map(&kb, i), batch_key(&kb, i), kb.hashes[i]);
+    }
+    if (deleted) aof_log(cmd->argc, cmd->argv);
+    keys_unlock(&kb);
+    if (deleted) aof_sync();
+
+    send_integer(conn, deleted);
+}
+
+// EXISTS key [key ...] (a key named twice counts twice)
+static void exists_command(struct connection *conn, RedisCmd *cmd) {
+    KeyBatch kb;
+    if (keys_lock(&kb, cmd, 1, 1) == -1) {
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+    long long found = 0;
+    for (size_t i = 0; i < kb.n; i++) {
+        found += hmap_lookup_hashed(batch_map(&kb, i), batch_key(&kb, i), kb.hashes[i]) != NULL;
+    }
+    keys_unlock(&kb);
+    send_integer(conn, found);
+}
+
+// Shared by INCR, DECR, INCRBY and DECRBY
+static void incr_generic(struct connection *conn, RedisCmd *cmd, int64_t delta) {
+    int64_t result;
+    HMap *db = store_lock(cmd->argv[1]);
+    int rc = hmap_incrby(db, cmd->argv[1], delta, &result);
+    // The command itself is logged (a few bytes), not the resulting value
+    if (rc == HMAP_OK) aof_log(cmd->argc, cmd->argv);
+    store_unlock(db);
+
+    if (rc == HMAP_ERR_NOT_INT) {
+        send_error(conn, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (rc == HMAP_ERR_OVERFLOW) {
+        send_error(conn, "ERR increment or decrement would overflow");
+        return;
+    }
+    if (rc == HMAP_ERR_WRONGTYPE) {
+        send_error(conn, K_ERR_WRONGTYPE);
+        return;
+    }
+    if (rc == HMAP_ERR_OOM) {
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+
+    aof_sync();
+    send_integer(conn, result);
+}
+
+// INCR key
+static void incr_command(struct connection *conn, RedisCmd *cmd) {
+    incr_generic(conn, cmd, 1);
+}
+
+// DECR key
+static void decr_command(struct connection *conn, RedisCmd *cmd) {
+    incr_generic(conn, cmd, -1);
+}
+
+// INCRBY key increment
+static void incrby_command(struct connection *conn, RedisCmd *cmd) {
+    int64_t delta;
+    if (!slice_to_int64(cmd->argv[2], &delta)) {
+        send_error(conn, "ERR value is not an integer or out of range");
+        return;
+    }
+    incr_generic(conn, cmd, delta);
+}
+
+// DECRBY key decrement
+static void decrby_command(struct connection *conn, RedisCmd *cmd) {
+    int64_t delta;
+    if (!slice_to_int64(cmd->argv[2], &delta)) {
+        send_error(conn, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (delta == INT64_MIN) {
+        send_error(conn, "ERR decrement would overflow");
+        return;
+    }
+    incr_generic(conn, cmd, -delta);
+}
+
+// Shared by EXPIRE, PEXPIRE and PEXPIREAT: `base` + argv[2] * `unit` ms.
+// Relative times are logged to the AOF as an absolute PEXPIREAT, so a
+// replay later on still expires the key at the original moment.
+static void expire_generic(struct connection *conn, RedisCmd *cmd, int64_t base, int64_t unit) {
+    int64_t when;
+    if (!slice_to_int64(cmd->argv[2], &when)) {
+        send_error(conn, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (__builtin_mul_overflow(when, unit, &when) || __builtin_add_overflow(when, base, &when)) {
+        send_error(conn, "ERR invalid expire time");
+        return;
+    }
+
+    HMap *db = store_lock(cmd->argv[1]);
+    if (!hmap_set_expire(db, cmd->argv[1], when)) {
+        store_unlock(db);
+        send_integer(conn, 0);
+        return;
+    }
+
+    char buf[INT64_STR_MAX];
+    Slice argv[3] = {slice_cstr("PEXPIREAT"), cmd->argv[1], {buf, int64_to_chars(when, buf)}};
+    aof_log(3, argv);
+    store_unlock(db);
+    aof_sync();
+
+    send_integer(conn, 1);
+}
+
+// EXPIRE key seconds
+static void expire_command(struct connection *conn, RedisCmd *cmd) {
+    expire_generic(conn, cmd, store_mstime(), 1000);
+}
+
+// PEXPIRE key milliseconds
+static void pexpire_command(struct connection *conn, RedisCmd *cmd) {
+    expire_generic(conn, cmd, store_mstime(), 1);
+}
+
+// PEXPIREAT key unix-time-milliseconds
+static void pexpireat_command(struct connection *conn, RedisCmd *cmd) {
+    expire_generic(conn, cmd, 0, 1);
+}
+
+// Shared by TTL and PTTL: -2 if the key does not exist, -1 if it has no TTL
+static void ttl_generic(struct connection *conn, RedisCmd *cmd, int in_ms) {
+    HMap *db = store_lock(cmd->argv[1]);
+    int64_t when = hmap_get_expire(db, cmd->argv[1]);
+    store_unlock(db);
+    if (when < 0) {
+        send_integer(conn, when);
+        return;
+    }
+    int64_t left = when - store_mstime();
+    if (left < 0) left = 0;
+    send_integer(conn, in_ms ? left : (left + 500) / 1000);
+}
+
+// TTL key
+static void ttl_command(struct connection *conn, RedisCmd *cmd) {
+    ttl_generic(conn, cmd, 0);
+}
+
+// PTTL key
+static void pttl_command(struct connection *conn, RedisCmd *cmd) {
+    ttl_generic(conn, cmd, 1);
+}
+
+// PERSIST key
+static void persist_command(struct connection *conn, RedisCmd *cmd) {
+    HMap *db = store_lock(cmd->argv[1]);
+    int removed = hmap_persist(db, cmd->argv[1]);
+    if (removed) aof_log(cmd->argc, cmd->argv);
+    store_unlock(db);
+    if (removed) aof_sync();
+    send_integer(conn, removed);
+}
+
+// --- SCAN ---
+
+#define K_SCAN_COUNT 10 // Default COUNT
+
+// Keys found by one SCAN call, copied out while their shard is locked:
+// each is a size_t length followed by the bytes
+typedef struct ScanKeys {
+    const Slice *match; // MATCH pattern, or NULL
+    char *buf;
+    size_t used;
+    size_t cap;
+    size_t n;
+    int oom;
+} ScanKeys;
+
+static void scan_collect(HNode *node, void *arg) {
+    ScanKeys *sk = arg;
+    Slice key = hnode_key_slice(node);
+    if (sk->match && !slice_glob_match(*sk->match, key)) return;
+
+    size_t need = sk->used + sizeof(size_t) + key.len;
+    if (need > sk->cap) {
+        size_t cap = sk->cap ? sk->cap * 2 : 1024;
+        while (cap < need) cap *= 2;
+        char *buf = mem_realloc(sk->buf, sk->cap, cap, MEM_CLIENT_REPLY);
+        if (!buf) {
+            sk->oom = 1;
+            return;
+        }
+        sk->buf = buf;
+        sk->cap = cap;
+    }
+    memcpy(sk->buf + sk->used, &key.len, sizeof(size_t));
+    memcpy(sk->buf + sk->used + sizeof(size_t), key.ptr, key.len);
+    sk->used = need;
+    sk->n++;
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count]
+// Each call walks a bounded number of buckets (see store_scan), so
+// enumerating a large keyspace never stalls other clients.
+static void scan_command(struct connection *conn, RedisCmd *cmd) {
+    int64_t cursor;
+    if (!slice_to_int64(cmd->argv[1], &cursor) || cursor < 0) {
+        send_error(conn, "ERR invalid cursor");
+        return;
+    }
+
+    ScanKeys sk = {0};
+    int64_t count = K_SCAN_COUNT;
+    for (int i = 2; i < cmd->argc; i += 2) {
+        Slice opt = cmd->argv[i];
+        if (i + 1 >= cmd->argc) {
+            send_error(conn, "ERR syntax error");
+            return;
+        }
+        if (opt.len == 5 && strncasecmp(opt.ptr, "match", 5) == 0) {
+            sk.match = &cmd->argv[i + 1];
+        } else if (opt.len == 5 && strncasecmp(opt.ptr, "count", 5) == 0) {
+            if (!slice_to_int64(cmd->argv[i + 1], &count)) {
+                send_error(conn, "ERR value is not an integer or out of range");
+                return;
+            }
+            if (count < 1) {
+                send_error(conn, "ERR syntax error");
+                return;
+            }
+        } else {
+            send_error(conn, "ERR syntax error");
+            return;
+        }
+    }
+
+    uint64_t next = store_scan((uint64_t)cursor, (size_t)count, scan_collect, &sk);
+    if (sk.oom) {
+        mem_free(sk.buf, sk.cap, MEM_CLIENT_REPLY);
+        send_error(conn, "ERR out of memory");
+        return;
+    }
+
+    char buf[INT64_STR_MAX];
+    send_array_len(conn, 2);
+    send_bulk_slice(conn, (Slice){buf, int64_to_chars((int64_t)next, buf)});
+    send_array_len(conn, (long long)sk.n);
+    for (size_t off = 0; off < sk.used; ) {
+        size_t len;
+        memcpy(&len, sk.buf + off, sizeof(size_t));
+        send_bulk_slice(conn, (Slice){sk.buf + off + sizeof(size_t), len});
+        off += sizeof(size_t) + len;
+    }
+    mem_free(sk.buf, sk.cap, MEM_CLIENT_REPLY);
+}
+
+// --- Sorted Sets ---
+// Members and scores are copied into the reply while the shard is locked.
+// Writes are logged as given: replaying a ZADD or ZREM rebuilds the same set.
+
+static int arg_is(Slice arg, const char *name) {
+    size_t len = strlen(name);
+    return arg.len == len && strncasecmp(arg.ptr, name, len) == 0;
+}
+
+// Lock the key's shard and return its set. On NULL the shard is unlocked
+// again and, if the key holds a string, the error has been sent.
+static ZSet *zset_lock(struct connection *conn, Slice key, HMap **db, int *wrongtype) {
+    *db = store_lock(key);
+    ZSet *zs = hmap_zset(*db, key, 0, wrongtype);
+    if (zs) return zs;
+    store_unlock(*db);
+    if (*wrongtype) send_error(conn, K_ERR_WRONGTYPE);
+    return NULL;
+}
+
+static void send_score(struct connection *conn, double score) {
+    char buf[DOUBLE_STR_MAX];
+    send_bulk_slice(conn, (Slice){buf, double_to_chars(score, buf)});
+}
+
+typedef struct ZReply {
+    struct connection *conn;
+    int withscores;
+} ZReply;
+
+static void zrange_reply(Slice member, double score, void *arg) {
+    ZReply *r = arg;
+    send_bulk_slice(r->conn, member);
+    if (r->withscores) send_score(r->conn, score);
+}
+
+// Ranks start..stop of the set as an array, then unlock
+static void zrange_send(struct connection *conn, HMap *db, ZSet *zs, size_t start, size_t stop,
+                        int rev, int withscores) {
+    ZReply r = {conn, withscores};
+    send_array_len(conn, (long long)(stop - start + 1) * (withscores ? 2 : 1));
+    zset_range(zs, start, stop, rev, zrange_reply, &r);
+    store_unlock(db);
+}
+
+// ZADD key [NX|XX] [GT|LT] [CH] score member [score member ...]
+static void zadd_command(struct connection *conn, RedisCmd *cmd) {
+    int flags = 0, ch = 0, i = 2;
+    for (; i < cmd->argc; i++) {
+        Slice opt = cmd->argv[i];
+        if (arg_is(opt, "nx")) {
+            flags |= ZADD_NX;
+        } else if (arg_is(opt, "xx")) {
+            flags |= ZADD_XX;
+        } else if (arg_is(opt, "gt")) {
+            flags |= ZADD_GT;
+        } else if (arg_is(opt, "lt")) {
+            flags |= ZADD_LT;
+        } else if (arg_is(opt, "ch")) {
+            ch = 1;
+        } else {
+            break;
+        }
+    }
+    if (i == cmd->argc || (cmd->argc - i) % 2) {
+        send_error(conn, "ERR syntax error");
+        return;
+    }
+    if ((flags & ZADD_NX) && (flags & ZADD_XX)) {
+        send_error(conn, "ERR XX and NX options at the same time are not compatible");
+        return;
+    }
+    if (((flags & ZADD_GT) && (flags & (ZADD_LT | ZADD_NX))) ||
+        ((flags & ZADD_LT) && (flags & ZADD_NX))) {
+        send_error(conn, "ERR GT, LT, and/or NX options at the same time are not compatible");
+        return;
+    }
+    // Every score is checked before anything changes
+    double score;
+    for (int j = i; j < cmd->argc; j += 2) {
+        if (!slice_to_double(cmd->argv[j], &score)) {
+            send_error(conn, "ERR value is not a valid float");
+            return;
+        }
+    }
+
+    int wrongtype;
+    HMap *db = store_lock(cmd->argv[1]);
+    ZSet *zs = hmap_zset(db, cmd->argv[1], !(flags & ZADD_XX), &wrongtype);
+    if (!zs) {
+        store_unlock(db);
+        if (wrongtype) {
+            send_error(conn, K_ERR_WRONGTYPE);
+        } else if (flags & ZADD_XX) {
+            send_integer(conn, 0);
+        } else {
+            send_error(conn, "ERR out of memory");
+        }
+        return;
+    }
+
+    long long added = 0, updated = 0;
+    int oom = 0;
+    for (int j = i; j < cmd->argc && !oom; j += 2) {
+        slice_to_double(cmd->argv[j], &score);
+        switch (zset_add(zs, score, cmd->argv[j + 1], flags)) {
+        case ZADD_ADDED: added++; break;
+        case ZADD_UPDATED: updated++; break;
+        case ZADD_OOM: oom = 1; break;
+        }
+    }
+    if (added + updated) aof_log(cmd->argc, cmd->argv);
+    if (zset_card(zs) == 0) hmap_delete(db, cmd->argv[1]); // Never keep an empty set
+    store_unlock(db);
+    if (added + updated) aof_sync();
+
+    if (oom) {
+        send_error(conn, "ERR out of memory");
+    } else {
+        send_integer(conn, ch ? added + updated : added);
+    }
+}
+
+// ZREM key member [member ...]
+static void zrem_command(struct connection *conn, RedisCmd *cmd) {
+    int wrongtype;
+    HMap *db;
+    ZSet *zs = zset_lock(conn, cmd->argv[1], &db, &wrongtype);
+    if (!zs) {
+        if (!wrongtype) send_integer(conn, 0);
+        return;
+    }
+    long long removed = 0;
+    for (int i = 2; i < cmd->argc; i++) removed += zset_remove(zs, cmd->argv[i]);
+    if (removed) aof_log(cmd->argc, cmd->argv);
+    if (zset_card(zs) == 0) hmap_delete(db, cmd->argv[1]);
+    store_unlock(db);
+    if (removed) aof_sync();
+    send_integer(conn, removed);
+}
+
+// ZCARD key
+static void zcard_command(struct connection *conn, RedisCmd *cmd) {
+    int wrongtype;
+    HMap *db;
+    ZSet *zs = zset_lock(conn, cmd->argv[1], &db, &wrongtype);
+    if (!zs) {
+        if (!wrongtype) send_integer(conn, 0);
+        return;
+    }
+    long long card = (long long)zset_card(zs);
+    store_unlock(db);
+    send_integer(conn, card);
+}
+
+// ZSCORE key member
+static void zscore_command(struct connection *conn, RedisCmd *cmd) {
+    int wrongtype;
+    HMap *db;
+    ZSet *zs = zset_lock(conn, cmd->argv[1], &db, &wrongtype);
+    if (!zs) {
+        if (!wrongtype) send_bulk_string(conn, NULL);
+        return;
+    }
+    double score;
+    int found = zset_score(zs, cmd->argv[2], &score);
+    store_unlock(db);
+    if (found) {
+        send_score(conn, score);
+    } else {
+        send_bulk_string(conn, NULL);
+    }
+}
+
+// Shared by ZRANK and ZREVRANK
+static void zrank_generic(struct connection *conn, RedisCmd *cmd, int rev) {
+    int wrongtype;
+    HMap *db;
+    ZSet *zs = zset_lock(conn, cmd->argv[1], &db, &wrongtype);
+    if (!zs) {
+        if (!wrongtype) send_bulk_string(conn, NULL);
+        return;
+    }
+    long long rank = zset_rank(zs, cmd->argv[2]);
+    if (rank >= 0 && rev) rank = (long long)zset_card(zs) - 1 - rank;
+    store_unlock(db);
+    if (rank < 0) {
+        send_bulk_string(conn, NULL);
+    } else {
+        send_integer(conn, rank);
+    }
+}
+
+// ZRANK key member
+static void zrank_command(struct connection *conn, RedisCmd *cmd) {
+    zrank_generic(conn, cmd, 0);
+}
+
+// ZREVRANK key member
+static void zrevrank_command(struct connection *conn, RedisCmd *cmd) {
+    zrank_generic(conn, cmd, 1);
+}
+
+// ZRANGE key start stop [REV] [WITHSCORES]
+// Negative ranks count from the end; with REV, rank 0 is the highest
+// score, so "ZRANGE board 0 9 REV" is the top ten.
+static void zrange_command(struct connection *conn, RedisCmd *cmd) {
+    int64_t start, stop;
+    if (!slice_to_int64(cmd->argv[2], &start) || !slice_to_int64(cmd->argv[3], &stop)) {
+        send_error(conn, "ERR value is not an integer or out of range");
+        return;
+    }
+    int rev = 0, withscores = 0;
+    for (int i = 4; i < cmd->argc; i++) {
+        if (arg_is(cmd->argv[i], "rev")) {
+            rev = 1;
+        } else if (arg_is(cmd->argv[i], "withscores")) {
+            withscores = 1;
+        } else {
+            send_error(conn, "ERR syntax error");
+            return;
+        }
+    }
+
+    int wrongtype;
+    HMap *db;
+    ZSet *zs = zset_lock(conn, cmd->argv[1], &db, &wrongtype);
+    if (!zs) {
+        if (!wrongtype) send_array_len(conn, 0);
+        return;
+    }
+    int64_t card = (int64_t)zset_card(zs);
+    if (start < 0) start += card;
+    if (stop < 0) stop += card;
+    if (start < 0) start = 0;
+    if (stop >= card) stop = card - 1;
+    if (start > stop) {
+        store_unlock(db);
+        send_array_len(conn, 0);
+        return;
+    }
+    zrange_send(conn, db, zs, (size_t)start, (size_t)stop, rev, withscores);
+}
+
+// A ZRANGEBYSCORE bound: "1.5", "(1.5" (exclusive), "-inf", "+inf"
+static int parse_score_bound(Slice s, double *score, int *exclusive) {
+    *exclusive = s.len > 0 && s.ptr[0] == '(';
+    if (*exclusive) {
+        s.ptr++;
+        s.len--;
+    }
+    return slice_to_double(s, score);
+}
+
+// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
+// The interval's ranks are found in O(log n), then walked like ZRANGE.
+static void zrangebyscore_command(struct connection *conn, RedisCmd *cmd) {
+    ZScoreRange range;
+    if (!parse_score_bound(cmd->argv[2], &range.min, &range.minex) ||
+        !parse_score_bound(cmd->argv[3], &range.max, &range.maxex)) {
+        send_error(conn, "ERR min or max is not a float");
+        return;
+    }
+    int withscores = 0;
+    int64_t offset = 0, count = -1;
+    for (int i = 4; i < cmd->argc; i++) {
+        if (arg_is(cmd->argv[i], "withscores")) {
+            withscores = 1;
+        } else if (arg_is(cmd->argv[i], "limit") && i + 2 < cmd->argc) {
+            if (!slice_to_int64(cmd->argv[i + 1], &offset) ||
+                !slice_to_int64(cmd->argv[i + 2], &count)) {
+                send_error(conn, "ERR value is not an integer or out of range");
+                return;
+            }
+            i += 2;
+        } else {
+            send_error(conn, "ERR syntax error");
+            return;
+        }
+    }
+
+    int wrongtype;
+    HMap *db;
+    ZSet *zs = zset_lock(conn, cmd->argv[1], &db, &wrongtype);
+    if (!zs) {
+        if (!wrongtype) send_array_len(conn, 0);
+        return;
+    }
+    size_t first, last;
+    if (!zset_score_ranks(zs, &range, &first, &last) || offset < 0 ||
+        (uint64_t)offset > last - first || count == 0) {
+        store_unlock(db);
+        send_array_len(conn, 0);
+        return;
+    }
+    size_t start = first + (size_t)offset;
+    size_t stop = last;
+    if (count > 0 && (uint64_t)count <= stop - start) stop = start + (size_t)count - 1;
+    zrange_send(conn, db, zs, start, stop, 0, withscores);
+}
+
+// MEMORY USAGE key
+static void memory_command(struct connection *conn, RedisCmd *cmd) {
+    Slice sub = cmd->argv[1];
+    if (sub.len == 5 && strncasecmp(sub.ptr, "usage", 5) == 0 && cmd->argc == 3) {
+        HMap *db = store_lock(cmd->argv[2]);
+        int64_t bytes = hmap_memory_usage(db, cmd->argv[2]);
+        store_unlock(db);
+        if (bytes < 0) {
+            send_bulk_string(conn, NULL);
+        } else {
+            send_integer(conn, bytes);
+        }
+        return;
+    }
+    send_error(conn, "ERR unknown subcommand or wrong number of arguments for 'memory' command");
+}
+
+// PING
+static void ping_command(struct connection *conn, RedisCmd *cmd) {
+    (void)cmd;
+    send_simple_string(conn, "PING A RAI KUB");
+}
+
+// Is `name` the requested INFO section? (no argument: every section)
+static int info_wants(RedisCmd *cmd, const char *name) {
+    if (cmd->argc < 2) return 1;
+    return cmd->argv[1].len == strlen(name) &&
+           strncasecmp(cmd->argv[1].ptr, name, cmd->argv[1].len) == 0;
+}
+
+// INFO [section]
+static void info_command(struct connection *conn, RedisCmd *cmd) {
+    char buf[16384];
+    size_t len = 0;
+    if (info_wants(cmd, "commandstats")) {
+        len += command_stats_info(buf + len, sizeof(buf) - len);
+    }
+    if (info_wants(cmd, "memory")) {
+        if (len) len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+        len += store_memory_info(buf + len, sizeof(buf) - len);
+    }
+    if (info_wants(cmd, "keyspace")) {
+        if (len) len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+        len += store_keyspace_info(buf + len, sizeof(buf) - len);
+    }
+    if (info_wants(cmd, "allocator")) {
+        if (len) len += snprintf(buf + len, sizeof(buf) - len, "\r\n"); // Blank line between sections
+        len += store_alloc_info(buf + len, sizeof(buf) - len);
+    }
+    send_bulk_slice(conn, (Slice){buf, len});
+}
+
+// --- Command Table ---
+// name, namelen, proc, arity, flags (stats start at zero)
+static RedisCommand command_table[] = {
+    {"get",       0, get_command,        2,  CMD_READONLY,             0, 0, 0},
+    {"set",       0, set_command,        3,  CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"del",       0, del_command,        -2, CMD_WRITE,                0, 0, 0},
+    {"exists",    0, exists_command,     -2, CMD_READONLY,             0, 0, 0},
+    {"mget",      0, mget_command,       -2, CMD_READONLY,             0, 0, 0},
+    {"mset",      0, mset_command,       -3, CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"msetnx",    0, msetnx_command,     -3, CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"incr",      0, incr_command,       2,  CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"decr",      0, decr_command,       2,  CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"incrby",    0, incrby_command,     3,  CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"decrby",    0, decrby_command,     3,  CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"expire",    0, expire_command,     3,  CMD_WRITE,                0, 0, 0},
+    {"pexpire",   0, pexpire_command,    3,  CMD_WRITE,                0, 0, 0},
+    {"pexpireat", 0, pexpireat_command,  3,  CMD_WRITE,                0, 0, 0},
+    {"persist",   0, persist_command,    2,  CMD_WRITE,                0, 0, 0},
+    {"scan",      0, scan_command,       -2, CMD_READONLY,             0, 0, 0},
+    {"zadd",      0, zadd_command,       -4, CMD_WRITE | CMD_DENYOOM,  0, 0, 0},
+    {"zrem",      0, zrem_command,       -3, CMD_WRITE,                0, 0, 0},
+    {"zcard",     0, zcard_command,      2,  CMD_READONLY,             0, 0, 0},
+    {"zscore",    0, zscore_command,     3,  CMD_READONLY,             0, 0, 0},
+    {"zrank",     0, zrank_command,      3,  CMD_READONLY,             0, 0, 0},
+    {"zrevrank",  0, zrevrank_command,   3,  CMD_READONLY,             0, 0, 0},
+    {"zrange",    0, zrange_command,     -4, CMD_READONLY,             0, 0, 0},
+    {"zrangebyscore", 0, zrangebyscore_command, -4, CMD_READONLY,      0, 0, 0},
+    {"ttl",       0, ttl_command,        2,  CMD_READONLY,             0, 0, 0},
+    {"pttl",      0, pttl_command,       2,  CMD_READONLY,             0, 0, 0},
+    {"memory",    0, memory_command,     -2, CMD_READONLY,             0, 0, 0},
+    {"ping",      0, ping_command,       -1, 0,                        0, 0, 0},
+    {"info",      0, info_command,       -1, 0,                        0, 0, 0},
+};
+
+#define NUM_COMMANDS (sizeof(command_table) / sizeof(command_table[0]))
+#define LOOKUP_MAX_SIZE 1024 // Plenty of room to find a collision-free seed
+#define MAX_NAME_LEN 32
+
+// Perfect hash: every command owns its own slot, so a lookup is one hash
+// over the case-folded name plus one compare, however many commands exist.
+static RedisCommand *lookup_tab[LOOKUP_MAX_SIZE];
+static size_t lookup_mask;
+static uint32_t lookup_seed;
+
+// FNV-1a over the ASCII-lowercased name
+static uint32_t name_hash(const char *name, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)name[i];
+        c |= (unsigned char)(((unsigned)(c - 'A') < 26u) << 5); // Fold A-Z without a branch
+        h = (h ^ c) * 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+void command_table_init(void) {
+    size_t size = 4;
+    while (size < NUM_COMMANDS * 2) size *= 2;
+
+    for (;;) {
+        for (uint32_t seed = 0; seed < 4096; seed++) {
+            int ok = 1;
+            memset(lookup_tab, 0, sizeof(lookup_tab));
+            for (size_t i = 0; i < NUM_COMMANDS && ok; i++) {
+                RedisCommand *c = &command_table[i];
+                c->namelen = strlen(c->name);
+                size_t pos = name_hash(c->name, c->namelen, seed) & (size - 1);
+                if (lookup_tab[pos]) {
+                    ok = 0; // Collision: try the next seed
+                } else {
+                    lookup_tab[pos] = c;
+                }
+            }
+            if (ok) {
+                lookup_mask = size - 1;
+                lookup_seed = seed;
+                return;
+            }
+        }
+        size *= 2; // Too crowded, give the hash more room
+        if (size > LOOKUP_MAX_SIZE) {
+            fprintf(stderr, "command table: no perfect hash found\n");
+            exit(1);
+        }
+    }
+}
+
+RedisCommand *command_lookup(const char *name, size_t len) {
+    if (len == 0 || len > MAX_NAME_LEN) return NULL;
+
+    RedisCommand *c = lookup_tab[name_hash(name, len, lookup_seed) & lookup_mask];
+    if (c && c->namelen == len && strncasecmp(c->name, name, len) == 0) {
+        return c;
+    }
+    return NULL;
+}
+
+int command_check_arity(const RedisCommand *c, int argc) {
+    return (c->arity > 0) ? (argc == c->arity) : (argc >= -c->arity);
+}
+
+size_t command_stats_info(char *buf, size_t size) {
+    size_t len = snprintf(buf, size, "# Commandstats\r\n");
+    for (size_t i = 0; i < NUM_COMMANDS && len < size; i++) {
+        RedisCommand *c = &command_table[i];
+        unsigned long long calls = __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+        unsigned long long usec = __atomic_load_n(&c->usec, __ATOMIC_RELAXED);
+        unsigned long long rejected = __atomic_load_n(&c->rejected_calls, __ATOMIC_RELAXED);
+        if (calls == 0 && rejected == 0) continue;
+        len += snprintf(buf + len, size - len,
+                        "cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f,rejected_calls=%llu\r\n",
+                        c->name, calls, usec,
+                        calls ? (double)usec / calls : 0.0, rejected);
+    }
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // for strcasecmp
+#include "config.h"
+#include "store.h"
+
+static struct server_config g_config = {
+    .port = "3490",
+    .obuf_hard_limit = 256 * 1024 * 1024,
+    .obuf_soft_limit = 64 * 1024 * 1024,
+    .obuf_soft_seconds = 60,
+    .maxmemory = 0,
+    .maxmemory_policy = EVICT_NOEVICTION,
+    .maxmemory_samples = 5,
+    .threads = 1,
+    .io_threads = 1,
+};
+
+// Parse a byte count with an optional unit: "512", "64kb", "256mb", "1gb"
+static int parse_memory(const char *str, size_t *out) {
+    char *end;
+    unsigned long long val = strtoull(str, &end, 10);
+    if (end == str) return -1;
+
+    unsigned long long mul = 1;
+    if (*end == '\0' || strcasecmp(end, "b") == 0) {
+        mul = 1;
+    } else if (strcasecmp(end, "k") == 0 || strcasecmp(end, "kb") == 0) {
+        mul = 1024ULL;
+    } else if (strcasecmp(end, "m") == 0 || strcasecmp(end, "mb") == 0) {
+        mul = 1024ULL * 1024;
+    } else if (strcasecmp(end, "g") == 0 || strcasecmp(end, "gb") == 0) {
+        mul = 1024ULL * 1024 * 1024;
+    } else {
+        return -1;
+    }
+    *out = (size_t)(val * mul);
+    return 0;
+}
+
+static int parse_int(const char *str, int *out) {
+    char *end;
+    long val = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || val < 0) return -1;
+    *out = (int)val;
+    return 0;
+}
+
+static int parse_policy(const char *str, int *out) {
+    static const struct { const char *name; int policy; } policies[] = {
+        {"noeviction", EVICT_NOEVICTION},
+        {"allkeys-lru", EVICT_ALLKEYS_LRU},
+        {"allkeys-lfu", EVICT_ALLKEYS_LFU},
+        {"volatile-ttl", EVICT_VOLATILE_TTL},
+    };
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcasecmp(str, policies[i].name) == 0) {
+            *out = policies[i].policy;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Apply one "name value" setting
+static int config_set(const char *name, const char *value) {
+    if (strcasecmp(name, "port") == 0) {
+        if (strlen(value) >= sizeof(g_config.port)) return -1;
+        strcpy(g_config.port, value);
+        return 0;
+    } else if (strcasecmp(name, "obuf-hard-limit") == 0) {
+        return parse_memory(value, &g_config.obuf_hard_limit);
+    } else if (strcasecmp(name, "obuf-soft-limit") == 0) {
+        return parse_memory(value, &g_config.obuf_soft_limit);
+    } else if (strcasecmp(name, "obuf-soft-seconds") == 0) {
+        return parse_int(value, &g_config.obuf_soft_seconds);
+    } else if (strcasecmp(name, "maxmemory") == 0) {
+        return parse_memory(value, &g_config.maxmemory);
+    } else if (strcasecmp(name, "maxmemory-policy") == 0) {
+        return parse_policy(value, &g_config.maxmemory_policy);
+    } else if (strcasecmp(name, "maxmemory-samples") == 0) {
+        return parse_int(value, &g_config.maxmemory_samples);
+    } else if (strcasecmp(name, "threads") == 0) {
+        if (parse_int(value, &g_config.threads) == -1) return -1;
+        return g_config.threads >= 1 && g_config.threads <= CONFIG_MAX_THREADS ? 0 : -1;
+    } else if (strcasecmp(name, "io-threads") == 0) {
+        if (parse_int(value, &g_config.io_threads) == -1) return -1;
+        return g_config.io_threads >= 1 && g_config.io_threads <= CONFIG_MAX_IO_THREADS ? 0 : -1;
+    }
+    return -1;
+}
+
+int config_load_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i += 2) {
+        if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+            fprintf(stderr, "Bad argument '%s' (expected --name value)\n", argv[i]);
+            return -1;
+        }
+        if (config_set(argv[i] + 2, argv[i + 1]) == -1) {
+            fprintf(stderr, "Bad config option '%s %s'\n", argv[i], argv[i + 1]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const struct server_config *config_get(void) {
+    return &g_config;
+}
@@ -1,57 +1,298 @@
+#include <errno.h>
+#include <string.h>
 #include "conn.h"
+#include "store.h"
+#include "mem.h"
 
-void add_to_pfds(struct pollfd **pfds, int newfd, int *fd_count, int *fd_size)
+int conn_watch(int epfd, struct connection *conn, uint32_t events)
 {
-    // If we don't have room, add more space in the pfds array
-    if (*fd_count == *fd_size) {
-        *fd_size *= 2; // Double it
-        struct pollfd *temp = realloc(*pfds, sizeof(**pfds) * (*fd_size));
+    struct epoll_event ev;
+    ev.events = events | EPOLLET; // Edge-triggered: we must drain until EAGAIN
+    ev.data.ptr = conn;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+}
 
-        if (temp != NULL) {
-            *pfds = temp;
-        } else {
-            perror("realloc");
-            exit(1);
-        }
-    }
+int conn_rewatch(int epfd, struct connection *conn, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = conn;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
 
-    (*pfds)[*fd_count].fd = newfd;
-    (*pfds)[*fd_count].events = POLLIN; // Check ready-to-read
-    (*pfds)[*fd_count].revents = 0;
+void conn_unwatch(int epfd, struct connection *conn)
+{
+    // Closing the fd would drop it from the set as well, but be explicit
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+}
 
-    (*fd_count)++;
+static inline size_t chunk_len(const struct reply_chunk *chunk)
+{
+    return chunk->ref_len + chunk->used;
 }
 
-void del_from_pfds(struct pollfd pfds[], int i, int *fd_count)
+static void free_chunk(struct reply_chunk *chunk)
 {
-    // Copy the one from the end over this one
-    pfds[i] = pfds[*fd_count-1];
+    if (chunk->pin) hnode_release(chunk->pin);
+    mem_free(chunk, sizeof(*chunk) + chunk->size, MEM_CLIENT_REPLY);
+}
 
-    (*fd_count)--;
+// Link a chunk at the end of the reply list
+static void push_chunk(struct connection *conn, struct reply_chunk *chunk)
+{
+    if (conn->reply_tail) {
+        conn->reply_tail->next = chunk;
+    } else {
+        conn->reply_head = chunk;
+    }
+    conn->reply_tail = chunk;
+    conn->reply_bytes += chunk_len(chunk);
 }
 
 struct connection *conn_create(int fd)
 {
-    struct connection *conn = malloc(sizeof(struct connection));
+    struct connection *conn = mem_malloc(sizeof(struct connection), MEM_CLIENT_OTHER);
     if (!conn) {
         return NULL;
     }
     conn->fd = fd;
-    conn->rbuf = malloc(INITIAL_BUF_SIZE);
+    conn->rbuf = mem_malloc(INITIAL_BUF_SIZE, MEM_CLIENT_QUERY);
     conn->rbuf_size = INITIAL_BUF_SIZE;
     conn->rbuf_used = 0;
-    conn->wbuf = malloc(INITIAL_BUF_SIZE);
+    resp_parser_init(&conn->parser, 1);
+    conn->wbuf = mem_malloc(INITIAL_BUF_SIZE, MEM_CLIENT_REPLY);
     conn->wbuf_size = INITIAL_BUF_SIZE;
     conn->wbuf_used = 0;
+    conn->wbuf_sent = 0;
+    conn->reply_head = NULL;
+    conn->reply_tail = NULL;
+    conn->reply_bytes = 0;
+    conn->reply_sent = 0;
+    conn->pending_write = 0;
+    conn->want_write = 0;
+    conn->close_asap = 0;
+    conn->obuf_soft_since = 0;
     conn->next = NULL;
+    conn->pending_read = 0;
+    conn->next_read = NULL;
+    conn->io_ncmds = 0;
+    if (!conn->rbuf || !conn->wbuf) {
+        conn_free(conn);
+        return NULL;
+    }
+    conn->rbuf[0] = '\0';
     return conn;
 }
 
 void conn_free(struct connection *conn)
 {
     if (conn) {
-        if (conn->rbuf) free(conn->rbuf);
-        if (conn->wbuf) free(conn->wbuf);
-        free(conn);
+        mem_free(conn->rbuf, conn->rbuf_size, MEM_CLIENT_QUERY);
+        resp_parser_reset(&conn->parser);
+        mem_free(conn->wbuf, conn->wbuf_size, MEM_CLIENT_REPLY);
+        struct reply_chunk *chunk = conn->reply_head;
+        while (chunk) {
+            struct reply_chunk *next = chunk->next;
+            free_chunk(chunk);
+            chunk = next;
+        }
+        mem_free(conn, sizeof(*conn), MEM_CLIENT_OTHER);
+    }
+}
+
+int conn_reserve_rbuf(struct connection *conn, size_t extra)
+{
+    // Keep one spare byte for the NUL kept after the data
+    size_t need = conn->rbuf_used + extra + 1;
+    if (need <= conn->rbuf_size) return 0;
+    if (need > MAX_QUERY_BUF_SIZE) return -1;
+
+    size_t new_size = conn->rbuf_size;
+    while (new_size < need) new_size *= 2; // Double it
+    char *temp = mem_realloc(conn->rbuf, conn->rbuf_size, new_size, MEM_CLIENT_QUERY);
+    if (!temp) return -1;
+
+    conn->rbuf = temp;
+    conn->rbuf_size = new_size;
+    return 0;
+}
+
+void conn_consume_rbuf(struct connection *conn, size_t n)
+{
+    // Shift the partial frame (if any) to the front for the next read
+    if (n < conn->rbuf_used) {
+        memmove(conn->rbuf, conn->rbuf + n, conn->rbuf_used - n);
+    }
+    conn->rbuf_used -= n;
+    conn->rbuf[conn->rbuf_used] = '\0';
+}
+
+// Append to the chunk list, topping up the tail chunk first
+static int append_chunks(struct connection *conn, const char *data, size_t len)
+{
+    struct reply_chunk *tail = conn->reply_tail;
+
+    if (tail && tail->used < tail->size) {
+        size_t n = tail->size - tail->used;
+        if (n > len) n = len;
+        memcpy(tail->buf + tail->used, data, n);
+        tail->used += n;
+        conn->reply_bytes += n;
+        data += n;
+        len -= n;
+    }
+    if (len == 0) return 0;
+
+    size_t size = len > REPLY_CHUNK_SIZE ? len : REPLY_CHUNK_SIZE;
+    struct reply_chunk *chunk = mem_malloc(sizeof(*chunk) + size, MEM_CLIENT_REPLY);
+    if (!chunk) {
+        conn->close_asap = 1; // The reply is already partly queued
+        return -1;
+    }
+    chunk->next = NULL;
+    chunk->ref = NULL;
+    chunk->ref_len = 0;
+    chunk->size = size;
+    chunk->used = len;
+    chunk->pin = NULL;
+    memcpy(chunk->buf, data, len);
+
+    push_chunk(conn, chunk);
+    return 0;
+}
+
+int conn_add_reply(struct connection *conn, const char *data, size_t len)
+{
+    if (conn->close_asap) return -1; // An earlier reply was cut short
+
+    // Once anything sits in the chunk list, wbuf must not take new bytes
+    // or replies would go out of order.
+    if (!conn->reply_head) {
+        size_t need = conn->wbuf_used + len;
+        if (need > conn->wbuf_size && conn->wbuf_size < MAX_WBUF_SIZE) {
+            size_t new_size = conn->wbuf_size;
+            while (new_size < need && new_size < MAX_WBUF_SIZE) new_size *= 2; // Double it
+            char *temp = mem_realloc(conn->wbuf, conn->wbuf_size, new_size, MEM_CLIENT_REPLY);
+            if (!temp) {
+                // Out of memory: the client would only see part of the
+                // reply, so drop it instead
+                conn->close_asap = 1;
+                return -1;
+            }
+            conn->wbuf = temp;
+            conn->wbuf_size = new_size;
+        }
+
+        size_t n = conn->wbuf_size - conn->wbuf_used;
+        if (n > len) n = len;
+        memcpy(conn->wbuf + conn->wbuf_used, data, n);
+        conn->wbuf_used += n;
+        data += n;
+        len -= n;
+        if (len == 0) return 0;
+    }
+    return append_chunks(conn, data, len);
+}
+
+int conn_add_reply_ref(struct connection *conn, struct HNode *node,
+                       const char *data, size_t len)
+{
+    if (conn->close_asap) return -1;
+
+    struct reply_chunk *chunk = mem_malloc(sizeof(*chunk) + REPLY_REF_TAIL, MEM_CLIENT_REPLY);
+    if (!chunk) return conn_add_reply(conn, data, len); // Fall back to a copy
+
+    hnode_retain(node);
+    chunk->next = NULL;
+    chunk->ref = data;
+    chunk->ref_len = len;
+    chunk->size = REPLY_REF_TAIL;
+    chunk->used = 0;
+    chunk->pin = node;
+
+    push_chunk(conn, chunk);
+    return 0;
+}
+
+int conn_has_pending_output(const struct connection *conn)
+{
+    return conn->wbuf_sent < conn->wbuf_used || conn->reply_head != NULL;
+}
+
+size_t conn_output_size(const struct connection *conn)
+{
+    return (conn->wbuf_used - conn->wbuf_sent) + conn->reply_bytes;
+}
+
+// Drop `n` written bytes from the front of the output queue
+static void advance_output(struct connection *conn, size_t n)
+{
+    size_t pending = conn->wbuf_used - conn->wbuf_sent;
+    if (n < pending) {
+        conn->wbuf_sent += n;
+        return;
+    }
+    n -= pending;
+    conn->wbuf_used = 0;
+    conn->wbuf_sent = 0;
+
+    while (n > 0 && conn->reply_head) {
+        struct reply_chunk *chunk = conn->reply_head;
+        size_t left = chunk_len(chunk) - conn->reply_sent;
+        if (n < left) {
+            conn->reply_sent += n;
+            conn->reply_bytes -= n;
+            return;
+        }
+        n -= left;
+        conn->reply_bytes -= left;
+        conn->reply_sent = 0;
+        conn->reply_head = chunk->next;
+        if (!conn->reply_head) conn->reply_tail = NULL;
+        free_chunk(chunk);
+    }
+}
+
+int conn_flush(struct connection *conn)
+{
+    for (;;) {
+        struct iovec iov[CONN_IOV_MAX];
+        int cnt = 0;
+
+        if (conn->wbuf_sent < conn->wbuf_used) {
+            iov[cnt].iov_base = conn->wbuf + conn->wbuf_sent;
+            iov[cnt].iov_len = conn->wbuf_used - conn->wbuf_sent;
+            cnt++;
+        }
+        for (struct reply_chunk *chunk = conn->reply_head;
+             chunk && cnt < CONN_IOV_MAX - 1; chunk = chunk->next) {
+            // Up to two pieces: the referenced value, then buf
+            size_t off = (chunk == conn->reply_head) ? conn->reply_sent : 0;
+            if (off < chunk->ref_len) {
+                iov[cnt].iov_base = (char *)chunk->ref + off;
+                iov[cnt].iov_len = chunk->ref_len - off;
+                cnt++;
+                off = chunk->ref_len;
+            }
+            if (off < chunk_len(chunk)) {
+                iov[cnt].iov_base = chunk->buf + (off - chunk->ref_len);
+                iov[cnt].iov_len = chunk_len(chunk) - off;
+                cnt++;
+            }
+        }
+
+        if (cnt == 0) {
+            conn->wbuf_used = 0;
+            conn->wbuf_sent = 0;
+            return 1; // All sent
+        }
+
+        ssize_t n = writev(conn->fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        advance_output(conn, (size_t)n);
     }
 }
@@ -0,0 +1,29 @@
+#include "epoch.h"
+
+uint64_t epoch_global = 1; // 0 marks an idle slot
+__thread EpochSlot *epoch_self;
+
+static EpochSlot slots[EPOCH_MAX_THREADS];
+static int nslots;
+
+int epoch_register(void) {
+    if (epoch_self) return 0;
+    int i = __atomic_fetch_add(&nslots, 1, __ATOMIC_RELAXED);
+    if (i >= EPOCH_MAX_THREADS) return -1;
+    epoch_self = &slots[i];
+    return 0;
+}
+
+uint64_t epoch_safe(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t safe = __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST);
+    int n = __atomic_load_n(&nslots, __ATOMIC_RELAXED);
+    if (n > EPOCH_MAX_THREADS) n = EPOCH_MAX_THREADS;
+
+    // The oldest reader still inside holds back everything stamped since
+    for (int i = 0; i < n; i++) {
+        uint64_t active = __atomic_load_n(&slots[i].active, __ATOMIC_SEQ_CST);
+        if (active && active < safe) safe = active;
+    }
+    return safe;
+}
@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "iothreads.h"
+#include "mem.h"
+
+#define K_IO_READ_MAX (1024 * 1024) // Bytes read per connection per round
+#define K_IO_SPIN 4096              // Polls before an idle helper goes to sleep
+
+// Where a parsed command's arguments sit in its worker's args array
+struct io_cmd {
+    int argc;
+    size_t arg;
+};
+
+struct io_worker {
+    IOPool *pool;
+    int id;
+    pthread_t thread;
+    int busy;                 // Set by the reactor to start a round, cleared when done
+    int sleeping;             // Parked on `wake` (see worker_main)
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    // Commands parsed during the current round, reused every round
+    struct io_cmd *cmds;
+    size_t ncmds, cmds_cap;
+    Slice *args;
+    size_t nargs, args_cap;
+} __attribute__((aligned(64)));
+
+struct IOPool {
+    int nthreads;
+    struct io_worker *workers;
+    // The round being run
+    int op;
+    struct connection **conns;
+    size_t nconns;
+};
+
+enum { IO_OP_READ, IO_OP_WRITE };
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Copy a command's argument views into the worker's arrays
+static int keep_command(struct io_worker *w, const RedisCmd *cmd) {
+    if (w->ncmds == w->cmds_cap) {
+        size_t cap = w->cmds_cap ? w->cmds_cap * 2 : 64;
+        struct io_cmd *cmds = mem_realloc(w->cmds, w->cmds_cap * sizeof(*cmds),
+                                          cap * sizeof(*cmds), MEM_CLIENT_QUERY);
+        if (!cmds) return -1;
+        w->cmds = cmds;
+        w->cmds_cap = cap;
+    }
+    if (w->nargs + cmd->argc > w->args_cap) {
+        size_t cap = w->args_cap ? w->args_cap : 256;
+        while (cap < w->nargs + cmd->argc) cap *= 2;
+        Slice *args = mem_realloc(w->args, w->args_cap * sizeof(*args),
+                                  cap * sizeof(*args), MEM_CLIENT_QUERY);
+        if (!args) return -1;
+        w->args = args;
+        w->args_cap = cap;
+    }
+    w->cmds[w->ncmds].argc = cmd->argc;
+    w->cmds[w->ncmds].arg = w->nargs;
+    memcpy(w->args + w->nargs, cmd->argv, cmd->argc * sizeof(Slice));
+    w->ncmds++;
+    w->nargs += cmd->argc;
+    return 0;
+}
+
+// recv() until EAGAIN (or the per-round cap), then parse every complete
+// frame. Nothing is parsed before the reads are done: growing rbuf would
+// move the bytes the parsed commands point at.
+static void read_conn(struct io_worker *w, struct connection *conn) {
+    conn->io_worker = w->id;
+    conn->io_first = w->ncmds;
+    conn->io_ncmds = 0;
+    conn->io_parsed = 0;
+
+    size_t room;
+    if (resp_parser_bulk_dest(&conn->parser, &room)) {
+        conn->io_status = IO_READ_DEFER;
+        return;
+    }
+
+    conn->io_status = IO_READ_OK;
+    for (size_t total = 0; ; ) {
+        if (total >= K_IO_READ_MAX) {
+            conn->io_status = IO_READ_MORE;
+            break;
+        }
+        if (conn_reserve_rbuf(conn, 4096) == -1) {
+            printf("Query buffer limit reached on socket %d\n", conn->fd);
+            conn->io_status = IO_READ_CLOSED;
+            break;
+        }
+        ssize_t nbytes = recv(conn->fd, conn->rbuf + conn->rbuf_used,
+                              conn->rbuf_size - conn->rbuf_used - 1, 0);
+        if (nbytes <= 0) {
+            if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (nbytes == -1 && errno == EINTR) continue;
+            if (nbytes == 0) {
+                printf("Socket %d hung up\n", conn->fd);
+            } else {
+                perror("recv");
+            }
+            conn->io_status = IO_READ_CLOSED; // Still run what arrived before
+            break;
+        }
+        conn->rbuf_used += nbytes;
+        conn->rbuf[conn->rbuf_used] = '\0';
+        total += nbytes;
+    }
+
+    // Keep every argument inside rbuf: a big bulk moved to its own buffer
+    // would be freed by resp_parser_reset before the command runs
+    int direct_ok = conn->parser.direct_ok;
+    conn->parser.direct_ok = 0;
+
+    size_t pos = 0;
+    while (pos < conn->rbuf_used) {
+        RedisCmd cmd;
+        size_t avail = conn->rbuf_used - pos;
+        int consumed = resp_parse(&conn->parser, conn->rbuf + pos, &avail, &cmd);
+        if (consumed == 0) break;
+        if (consumed < 0) {
+            if (conn->io_status != IO_READ_CLOSED) conn->io_status = IO_READ_PROTO;
+            break;
+        }
+        int kept = keep_command(w, &cmd);
+        free_redis_cmd(&cmd);
+        resp_parser_reset(&conn->parser);
+        if (kept == -1) break; // The reactor parses the rest itself
+        conn->io_ncmds++;
+        pos += consumed;
+    }
+    conn->parser.direct_ok = direct_ok;
+    conn->io_parsed = pos;
+}
+
+static void write_conn(struct connection *conn) {
+    conn->io_status = conn_flush(conn);
+    if (conn->io_status == -1) perror("writev");
+}
+
+// Worker i takes connections i, i + nthreads, ...
+static void run_share(struct io_worker *w) {
+    IOPool *pool = w->pool;
+    if (pool->op == IO_OP_READ) {
+        w->ncmds = 0;
+        w->nargs = 0;
+    }
+    for (size_t i = w->id; i < pool->nconns; i += pool->nthreads) {
+        if (pool->op == IO_OP_READ) {
+            read_conn(w, pool->conns[i]);
+        } else {
+            write_conn(pool->conns[i]);
+        }
+    }
+}
+
+// Helpers poll for a while after each round (pipelined clients come back
+// quickly), then sleep until the reactor wakes them
+static void *worker_main(void *arg) {
+    struct io_worker *w = arg;
+    for (;;) {
+        for (int spin = 0; !__atomic_load_n(&w->busy, __ATOMIC_ACQUIRE); spin++) {
+            if (spin < K_IO_SPIN) {
+                cpu_relax();
+                continue;
+            }
+            pthread_mutex_lock(&w->lock);
+            __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+            while (!__atomic_load_n(&w->busy, __ATOMIC_SEQ_CST)) {
+                pthread_cond_wait(&w->wake, &w->lock);
+            }
+            __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&w->lock);
+        }
+        run_share(w);
+        __atomic_store_n(&w->busy, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+IOPool *io_pool_create(int nthreads) {
+    IOPool *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->nthreads = nthreads;
+    pool->workers = aligned_alloc(64, nthreads * sizeof(struct io_worker));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    memset(pool->workers, 0, nthreads * sizeof(struct io_worker));
+
+    for (int i = 0; i < nthreads; i++) {
+        struct io_worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->id = i;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wake, NULL);
+        if (i == 0) continue; // The caller's own share
+        int rv = pthread_create(&w->thread, NULL, worker_main, w);
+        if (rv != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+int io_pool_size(const IOPool *pool) {
+    return pool->nthreads;
+}
+
+static void run_round(IOPool *pool, int op, struct connection **conns, size_t n) {
+    pool->op = op;
+    pool->conns = conns;
+    pool->nconns = n;
+
+    for (int i = 1; i < pool->nthreads; i++) {
+        struct io_worker *w = &pool->workers[i];
+        // Pairs with worker_main: either it sees busy, or we see it asleep
+        __atomic_store_n(&w->busy, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&w->lock);
+            pthread_cond_signal(&w->wake);
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+
+    run_share(&pool->workers[0]);
+
+    for (int i = 1; i < pool->nthreads; i++) {
+        struct io_worker *w = &pool->workers[i];
+        for (int spin = 0; __atomic_load_n(&w->busy, __ATOMIC_ACQUIRE); spin++) {
+            // Helpers may share a core with us: let them run
+            if (spin < K_IO_SPIN) {
+                cpu_relax();
+            } else {
+                sched_yield();
+            }
+        }
+    }
+}
+
+void io_pool_read(IOPool *pool, struct connection **conns, size_t n) {
+    run_round(pool, IO_OP_READ, conns, n);
+}
+
+void io_pool_command(const IOPool *pool, const struct connection *conn, size_t i,
+                     RedisCmd *cmd) {
+    const struct io_worker *w = &pool->workers[conn->io_worker];
+    const struct io_cmd *c = &w->cmds[conn->io_first + i];
+    cmd->argc = c->argc;
+    cmd->argv = w->args + c->arg;
+}
+
+void io_pool_write(IOPool *pool, struct connection **conns, size_t n) {
+    run_round(pool, IO_OP_WRITE, conns, n);
+}
@@ -2,12 +2,16 @@
 #include "server.h"
 #include "resp.h"
 #include "aof.h"
+#include "config.h"
 
-int main() {
+int main(int argc, char **argv) {
     printf("Mini-Redis Server starting\n");
+    if (config_load_args(argc, argv) == -1) {
+        return 1;
+    }
     // Initialization is now handled inside server_init
-    server_init("3490");
+    server_init(config_get()->port);
     server_run();
     aof_close();
     return 0;
-}
\ No newline at end of file
+}
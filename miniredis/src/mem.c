@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h> // malloc_trim
+#endif
+#include "mem.h"
+
+// Updated from every thread, once per node allocated or freed at most (one
+// per write), so plain atomic counters are cheap next to the command.
+static size_t g_used[MEM_NCATEGORIES];
+static size_t g_total;
+static size_t g_peak;
+
+static inline void mem_add(int cat, size_t size) {
+    __atomic_add_fetch(&g_used[cat], size, __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&g_total, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&g_peak, __ATOMIC_RELAXED);
+    while (total > peak &&
+           !__atomic_compare_exchange_n(&g_peak, &peak, total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void mem_sub(int cat, size_t size) {
+    __atomic_sub_fetch(&g_used[cat], size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&g_total, size, __ATOMIC_RELAXED);
+}
+
+void *mem_malloc(size_t size, int cat) {
+    void *ptr = malloc(size);
+    if (ptr) mem_add(cat, size);
+    return ptr;
+}
+
+void *mem_calloc(size_t n, size_t size, int cat) {
+    void *ptr = calloc(n, size);
+    if (ptr) mem_add(cat, n * size);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t old_size, size_t new_size, int cat) {
+    void *fresh = realloc(ptr, new_size);
+    if (fresh || new_size == 0) {
+        mem_sub(cat, old_size);
+        mem_add(cat, new_size);
+    }
+    return fresh;
+}
+
+void mem_free(void *ptr, size_t size, int cat) {
+    if (!ptr) return;
+    mem_sub(cat, size);
+    free(ptr);
+}
+
+void *mem_aligned_alloc(size_t align, size_t size, int cat) {
+    void *ptr;
+    if (posix_memalign(&ptr, align, size) != 0) return NULL;
+    mem_add(cat, size);
+    return ptr;
+}
+
+void mem_trim(void) {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+size_t mem_used(int cat) {
+    return __atomic_load_n(&g_used[cat], __ATOMIC_RELAXED);
+}
+
+size_t mem_used_total(void) {
+    return __atomic_load_n(&g_total, __ATOMIC_RELAXED);
+}
+
+size_t mem_peak(void) {
+    return __atomic_load_n(&g_peak, __ATOMIC_RELAXED);
+}
+
+size_t mem_rss(void) {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) return 0;
+    unsigned long size, resident;
+    int ok = fscanf(fp, "%lu %lu", &size, &resident) == 2;
+    fclose(fp);
+    return ok ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
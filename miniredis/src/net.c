@@ -8,7 +8,7 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-int get_listener_socket(const char *port)
+int get_listener_socket(const char *port, int reuseport)
 {
     int listener;     // Listening socket descriptor
     int yes=1;        // For setsockopt() SO_REUSEADDR, etc.
@@ -34,6 +34,12 @@ int get_listener_socket(const char *port)
         
         // Lose the pesky "address already in use" error message
         setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+        // Let every reactor thread bind its own socket to the port; the
+        // kernel then spreads incoming connections across them. Only then:
+        // it would also let a second server bind the port unnoticed.
+        if (reuseport) {
+            setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int));
+        }
 
         if (bind(listener, p->ai_addr, p->ai_addrlen) < 0) {
             close(listener);
@@ -51,7 +57,7 @@ int get_listener_socket(const char *port)
     freeaddrinfo(ai); // All done with this
 
     // Listen
-    if (listen(listener, 10) == -1) {
+    if (listen(listener, SOMAXCONN) == -1) { // Deep backlog for connection bursts
         return -1;
     }
 
@@ -65,11 +71,17 @@ int set_nonblocking(int fd)
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+int set_nodelay(int fd)
+{
+    int yes = 1;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
 int sendall(int s, char *buf, int *len)
 {
     int total = 0;        // how many bytes we've sent
     int bytesleft = *len; // how many we have left to send
-    int n;
+    int n = 0;
 
     while(total < *len) {
         n = send(s, buf+total, bytesleft, 0);
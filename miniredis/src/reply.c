@@ -0,0 +1,93 @@
+#include <string.h>
+#include "reply.h"
+
+// Queue reply bytes. If the output cannot be grown the reply would be cut
+// short, so the client is marked for closing and nothing more is queued.
+static void add_reply(struct connection *conn, const char *data, size_t len) {
+    if (conn->close_asap) return;
+    if (conn_add_reply(conn, data, len) == -1) conn->close_asap = 1;
+}
+
+static void add_reply_ref(struct connection *conn, HNode *node, const char *data, size_t len) {
+    if (conn->close_asap) return;
+    if (conn_add_reply_ref(conn, node, data, len) == -1) conn->close_asap = 1;
+}
+
+// Queue "<prefix><number>\r\n" (integer replies and bulk length headers)
+static void add_reply_prefixed_ll(struct connection *conn, char prefix, long long val) {
+    char buf[32];
+    char *p = buf + sizeof(buf);
+    unsigned long long v = val < 0 ? 0ULL - (unsigned long long)val : (unsigned long long)val;
+
+    *--p = '\n';
+    *--p = '\r';
+    do {
+        *--p = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    if (val < 0) *--p = '-';
+    *--p = prefix;
+
+    add_reply(conn, p, buf + sizeof(buf) - p);
+}
+
+void send_simple_string(struct connection *conn, const char *msg) {
+    if (!conn) return;
+    add_reply(conn, "+", 1);
+    add_reply(conn, msg, strlen(msg));
+    add_reply(conn, "\r\n", 2);
+}
+
+void send_error(struct connection *conn, const char *msg) {
+    if (!conn) return;
+    add_reply(conn, "-", 1);
+    add_reply(conn, msg, strlen(msg));
+    add_reply(conn, "\r\n", 2);
+}
+
+void send_bulk_string(struct connection *conn, const char *str) {
+    if (!conn) return;
+    if (!str) {
+        // Null Bulk String for non-existent keys ($-1\r\n)
+        add_reply(conn, "$-1\r\n", 5);
+        return;
+    }
+    send_bulk_slice(conn, slice_cstr(str));
+}
+
+void send_bulk_slice(struct connection *conn, Slice s) {
+    if (!conn) return;
+    add_reply_prefixed_ll(conn, '$', (long long)s.len);
+    add_reply(conn, s.ptr, s.len);
+    add_reply(conn, "\r\n", 2);
+}
+
+// Large values are not copied: the reply references the node's value directly
+// and pins the node until writev() has sent it.
+void send_bulk_value(struct connection *conn, HNode *node) {
+    if (!conn) return;
+    if (node->encoding == HNODE_ENC_INT) {
+        // Counters are kept as int64 and only turned into digits here
+        char buf[INT64_STR_MAX];
+        send_bulk_slice(conn, (Slice){buf, int64_to_chars(hnode_int(node), buf)});
+        return;
+    }
+    size_t len = node->vlen;
+    add_reply_prefixed_ll(conn, '$', (long long)len);
+    if (len < REPLY_ZEROCOPY_MIN) {
+        add_reply(conn, hnode_value(node), len);
+    } else {
+        add_reply_ref(conn, node, hnode_value(node), len);
+    }
+    add_reply(conn, "\r\n", 2);
+}
+
+void send_integer(struct connection *conn, long long val) {
+    if (!conn) return;
+    add_reply_prefixed_ll(conn, ':', val);
+}
+
+void send_array_len(struct connection *conn, long long n) {
+    if (!conn) return;
+    add_reply_prefixed_ll(conn, '*', n);
+}
@@ -1,148 +1,406 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "resp.h"
+#include "mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * CRLF scanners
+ * -------------
+ * find_crlf_*(buf, end) return a pointer to the first "\r\n" pair in
+ * [buf, end), or NULL. All of them are bounded by `end`, never by a
+ * terminator. The vector versions compare 16/32 bytes against '\r' and
+ * the same window shifted by one against '\n', so a pair is found with
+ * one AND + movemask per block. resp_init() picks the best one for the
+ * running CPU.
+ */
+static const char *find_crlf_scalar(const char *buf, const char *end) {
+    const char *cr = buf;
+    for (;;) {
+        cr = memchr(cr, '\r', end - cr);
+        if (!cr || cr + 1 >= end) {
+            return NULL;
+        }
+        if (cr[1] == '\n') return cr;
+        cr++;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static const char *find_crlf_sse2(const char *buf, const char *end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    // Each block also reads p[16], the '\n' partner of a '\r' at p[15]
+    while (end - buf >= 17) {
+        __m128i a = _mm_loadu_si128((const __m128i *)buf);
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf + 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr),
+                                                        _mm_cmpeq_epi8(b, lf)));
+        if (mask) return buf + __builtin_ctz(mask);
+        buf += 16;
+    }
+    return find_crlf_scalar(buf, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_crlf_avx2(const char *buf, const char *end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (end - buf >= 33) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(buf + 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+        if (mask) return buf + __builtin_ctz(mask);
+        buf += 32;
+    }
+    return find_crlf_sse2(buf, end);
+}
+#endif
+
+static const char *(*find_crlf)(const char *, const char *) = find_crlf_scalar;
+
+void resp_init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find_crlf = find_crlf_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        find_crlf = find_crlf_sse2;
+    }
+#endif
+}
 
 /*
  * Helper Function: read_line
  * --------------------------
- * Finds the first occurrence of "\r\n" (CRLF).
+ * Finds the first "\r\n" (CRLF) between buf and end.
+ * Bounded by `end`, so the buffer does not need a NUL terminator
+ * and may contain binary data.
  *
  * buf:      Pointer to the current position in the buffer.
+ * end:      One past the last readable byte.
  * line_len: Output pointer to store the length of the line (excluding CRLF).
  *
  * Returns:  Pointer to the beginning of the NEXT line (after \r\n),
  * or NULL if CRLF is not found.
  */
-static const char *read_line(const char *buf, int *line_len) {
-    const char *end = strstr(buf, "\r\n");
-    if (!end) {
+static const char *read_line(const char *buf, const char *end, size_t *line_len) {
+    const char *cr = find_crlf(buf, end);
+    if (!cr) {
         return NULL; // CRLF not found, data might be incomplete
     }
-    
-    *line_len = end - buf; // Calculate length of the current segment
-    return end + 2;        // Move pointer past "\r\n"
+
+    *line_len = cr - buf; // Calculate length of the current segment
+    return cr + 2;        // Move pointer past "\r\n"
+}
+
+/*
+ * Helper Function: parse_digits8
+ * ------------------------------
+ * Decodes up to 8 ASCII digits with a handful of multiplies (SWAR) instead
+ * of a per-digit loop. Requires 8 readable bytes at buf.
+ *
+ * Returns: 0 on success, -1 if any of the first `len` bytes is not a digit.
+ */
+static int parse_digits8(const char *buf, size_t len, long long *result) {
+    uint64_t v;
+    memcpy(&v, buf, 8); // Little-endian: buf[0] is the lowest byte
+    v -= 0x3030303030303030ULL;
+
+    // Right-align the digits; the vacated low bytes become leading zeros
+    v <<= 8 * (8 - len);
+    if (((v + 0x7676767676767676ULL) | v) & 0x8080808080808080ULL) {
+        return -1; // A byte was outside '0'..'9'
+    }
+
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+         (((v >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+    *result = (long long)v;
+    return 0;
 }
 
 /*
  * Helper Function: parse_int
  * --------------------------
- * Reads a line and converts it to an integer.
+ * Reads a line and converts it to a non-negative integer.
  * Used for parsing array size (*3) or string length ($5).
+ * Digits are decoded in place; nothing is copied.
+ * The CRLF is located first, so the digit count is known up front.
  *
  * buf:    Pointer to the current position.
+ * end:    One past the last readable byte.
  * result: Output pointer to store the parsed integer.
+ * next:   Output pointer to the beginning of the NEXT line.
  *
- * Returns: Pointer to the beginning of the NEXT line.
+ * Returns: 1 on success, 0 if the line is incomplete, -1 if malformed.
  */
-static const char *parse_int(const char *buf, int *result) {
-    int len;
-    const char *next = read_line(buf, &len);
-    if (!next) return NULL;
-
-    // Create a temporary buffer to safely null-terminate the number string
-    char num_buf[32];
-    if ((size_t)len >= sizeof(num_buf)) return NULL; // Safety check for overflow
-    
-    memcpy(num_buf, buf, len);
-    num_buf[len] = '\0';
-    
-    *result = atoi(num_buf);
-    return next;
+static int parse_int(const char *buf, const char *end, long long *result, const char **next) {
+    size_t len;
+    *next = read_line(buf, end, &len);
+    if (!*next) {
+        // No CRLF yet: either still arriving or a garbage header line
+        return (end - buf > 32) ? -1 : 0;
+    }
+    if (len == 0 || len > 18) return -1;
+
+    // Common case: short count/length with 8 bytes readable
+    if (len <= 8 && end - buf >= 8) {
+        return parse_digits8(buf, len, result) == 0 ? 1 : -1;
+    }
+
+    long long val = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned d = (unsigned char)buf[i] - '0';
+        if (d > 9) {
+            // "-1" (null) is legal RESP but meaningless inside a command
+            return -1;
+        }
+        val = val * 10 + d;
+    }
+    *result = val;
+    return 1;
 }
 
 /*
- * Main Function: parse_request
- * ----------------------------
- * Parses a raw RESP buffer into a RedisCmd struct.
- * Expected format: Array of Bulk Strings (e.g., *3\r\n$3\r\nSET\r\n...)
+ * Parser State Machine
+ * --------------------
+ * A frame is parsed in steps that survive across reads:
  *
- * buf: Raw input buffer from the client.
- * len: Length of the buffer.
- * cmd: Pointer to the RedisCmd struct to populate.
+ *   ARGC     waiting for the "*N" header
+ *   BULKLEN  waiting for the "$N" header of argument `argi`
+ *   BULK     waiting for N bytes + CRLF of a bulk string in the buffer
+ *   BIG      a large bulk string is being read straight into p->big
  *
- * Returns: 0 on success, negative value on error.
+ * `pos` remembers how far into the frame we got, so a resumed parse never
+ * rescans bytes it has already accepted. Arguments are stored as offsets
+ * from the frame start (the caller may move or realloc its buffer between
+ * calls) and only turned into pointers once the frame is complete.
  */
-int parse_request(char *buf, size_t len, RedisCmd *cmd) {
-    const char *ptr = buf;           // Cursor to traverse the buffer
-    const char *end_buf = buf + len; // Boundary check
+enum {
+    RESP_ST_ARGC,
+    RESP_ST_BULKLEN,
+    RESP_ST_BULK,
+    RESP_ST_BIG
+};
+
+void resp_parser_init(RespParser *p, int direct_ok) {
+    p->state = RESP_ST_ARGC;
+    p->direct_ok = direct_ok;
+    p->argc = 0;
+    p->argi = 0;
+    p->bulk_len = 0;
+    p->pos = 0;
+    p->args = p->args_inline;
+    p->big = NULL;
+    p->big_used = 0;
+}
+
+void resp_parser_reset(RespParser *p) {
+    for (long long i = 0; i < p->argi; i++) {
+        mem_free(p->args[i].own, p->args[i].len + 2, MEM_CLIENT_QUERY);
+    }
+    if (p->args != p->args_inline) {
+        mem_free(p->args, p->argc * sizeof(RespArg), MEM_CLIENT_QUERY);
+    }
+    mem_free(p->big, (size_t)p->bulk_len + 2, MEM_CLIENT_QUERY);
+    resp_parser_init(p, p->direct_ok);
+}
+
+char *resp_parser_bulk_dest(RespParser *p, size_t *room) {
+    if (p->state != RESP_ST_BIG) return NULL;
+    size_t need = (size_t)p->bulk_len + 2;
+    if (p->big_used >= need) return NULL;
+    *room = need - p->big_used;
+    return p->big + p->big_used;
+}
+
+void resp_parser_bulk_filled(RespParser *p, size_t n) {
+    p->big_used += n;
+}
 
-    // 1. Check if the buffer starts with the Array indicator '*'
-    if (*ptr != '*') {
-        return -1; // Invalid format (we only expect Arrays for commands)
+// Record a finished argument and move on to the next "$N" header
+static void push_arg(RespParser *p, size_t off, char *own) {
+    RespArg *arg = &p->args[p->argi++];
+    arg->off = off;
+    arg->len = (size_t)p->bulk_len;
+    arg->own = own;
+    p->state = RESP_ST_BULKLEN;
+}
+
+// All arguments are in: build the RedisCmd views
+static int finish_frame(RespParser *p, char *buf, RedisCmd *cmd) {
+    if (p->argc > RESP_INLINE_ARGS) {
+        // Only very wide commands need a heap array
+        cmd->argv = mem_malloc(p->argc * sizeof(Slice), MEM_CLIENT_QUERY);
+        if (cmd->argv == NULL) return -3; // Memory allocation failed
     }
-    ptr++; // Skip '*'
+    cmd->argc = (int)p->argc;
 
-    // 2. Read the number of arguments (argc)
-    int argc;
-    ptr = parse_int(ptr, &argc);
-    if (!ptr) {
-        return -2; // Error parsing integer or incomplete data
+    for (int i = 0; i < cmd->argc; i++) {
+        RespArg *arg = &p->args[i];
+        cmd->argv[i].ptr = arg->own ? arg->own : buf + arg->off;
+        cmd->argv[i].len = arg->len;
     }
+    return (int)p->pos; // Bytes of the frame held in buf
+}
 
-    cmd->argc = argc;
-    
-    // Allocate memory for the array of string pointers
-    // Note: We haven't allocated the strings themselves yet, just the container.
-    cmd->argv = malloc(sizeof(char*) * argc);
-    if (cmd->argv == NULL) return -3; // Memory allocation failed
-
-    cmd->name = NULL; 
-
-    // 3. Loop to parse each argument (Bulk String)
-    for (int i = 0; i < argc; i++) {
-        // Every argument must start with '$' (Bulk String)
-        if (*ptr != '$') {
-            // TODO: call a cleanup function here before returning
-            return -4; // Protocol error
-        }
-        ptr++; // Skip '$'
+/*
+ * Main Function: resp_parse
+ * -------------------------
+ * Parses (or resumes parsing) the RESP frame at the front of a buffer.
+ * Expected format: Array of Bulk Strings (e.g., *3\r\n$3\r\nSET\r\n...)
+ * The buffer may hold several pipelined frames, or only part of one.
+ *
+ * Zero-copy: argv entries are (pointer, length) views into `buf`, so
+ * arguments are binary-safe and never rescanned. Nothing is allocated
+ * unless the command has more than RESP_INLINE_ARGS arguments.
+ *
+ * Large bulk strings (>= RESP_BIG_BULK) that have not fully arrived are
+ * moved into a buffer of exactly the announced size. *len is then cut
+ * back to the end of the "$N" header, and the caller should recv() the
+ * rest straight into resp_parser_bulk_dest() - no rescans, no regrowth.
+ *
+ * p:   Parser state for this stream (reset it after using the command).
+ * buf: Raw input buffer from the client, starting at the frame.
+ * len: Length of the buffer (may be reduced, see above).
+ * cmd: Pointer to the RedisCmd struct to populate.
+ *
+ * Returns: Number of buffer bytes used by the frame (> 0) on success,
+ *          0 if the frame is incomplete (wait for more data),
+ *          negative value on protocol error.
+ */
+int resp_parse(RespParser *p, char *buf, size_t *len, RedisCmd *cmd) {
+    const char *end_buf = buf + *len; // Boundary check
 
-        // Read the length of the string
-        int str_len;
-        ptr = parse_int(ptr, &str_len);
-        if (!ptr) {
-            return -5;
-        }
+    cmd->argc = 0;
+    cmd->argv = cmd->argv_inline;
 
-        // Safety Check: Ensure we have enough data in the buffer
-        // We need: str_len bytes + 2 bytes for "\r\n"
-        if (ptr + str_len + 2 > end_buf) {
-            return -6; // Incomplete data
-        }
+    for (;;) {
+        const char *ptr = buf + p->pos; // Resume where we stopped
+        const char *next;
+        long long num;
+        int ok;
 
-        // Allocate memory for the string (+1 for Null Terminator)
-        cmd->argv[i] = malloc(str_len + 1);
-        if (cmd->argv[i] == NULL) return -7;
+        switch (p->state) {
+        case RESP_ST_ARGC:
+            if (ptr >= end_buf) return 0; // Nothing to parse yet
 
-        // Copy data and null-terminate
-        memcpy(cmd->argv[i], ptr, str_len);
-        cmd->argv[i][str_len] = '\0';
+            // Check if the frame starts with the Array indicator '*'
+            if (*ptr != '*') {
+                return -1; // Invalid format (we only expect Arrays for commands)
+            }
+            ok = parse_int(ptr + 1, end_buf, &num, &next);
+            if (ok <= 0 || num > RESP_MAX_ARGS) {
+                return ok == 0 ? 0 : -2; // Incomplete, or not a usable count
+            }
+            if (num > RESP_INLINE_ARGS) {
+                p->args = mem_malloc(num * sizeof(RespArg), MEM_CLIENT_QUERY);
+                if (p->args == NULL) {
+                    p->args = p->args_inline;
+                    return -3;
+                }
+            }
+            p->argc = num;
+            p->argi = 0;
+            p->pos = next - buf;
+            p->state = RESP_ST_BULKLEN;
+            break;
+
+        case RESP_ST_BULKLEN:
+            if (p->argi == p->argc) {
+                return finish_frame(p, buf, cmd);
+            }
+            if (ptr >= end_buf) return 0; // Incomplete data
+
+            // Every argument must start with '$' (Bulk String)
+            if (*ptr != '$') {
+                return -4; // Protocol error
+            }
+            ok = parse_int(ptr + 1, end_buf, &num, &next);
+            if (ok <= 0 || num > RESP_MAX_BULK_LEN) {
+                return ok == 0 ? 0 : -5;
+            }
+            p->bulk_len = num;
+            p->pos = next - buf;
+            p->state = RESP_ST_BULK;
+            break;
+
+        case RESP_ST_BULK: {
+            // We need: bulk_len bytes + 2 bytes for "\r\n"
+            size_t need = (size_t)p->bulk_len + 2;
+            size_t avail = end_buf - ptr;
 
-        // Set the command name (usually the first argument, e.g., "SET", "GET")
-        if (i == 0) {
-            cmd->name = cmd->argv[0];
+            if (avail < need) {
+                if (!p->direct_ok || p->bulk_len < RESP_BIG_BULK) {
+                    return 0; // Incomplete data
+                }
+                // Big payload: give it its own buffer of the announced size
+                p->big = mem_malloc(need, MEM_CLIENT_QUERY);
+                if (!p->big) return -7;
+                memcpy(p->big, ptr, avail);
+                p->big_used = avail;
+                *len = p->pos; // The payload bytes now live in p->big
+                p->state = RESP_ST_BIG;
+                return 0;
+            }
+            if (ptr[p->bulk_len] != '\r' || ptr[p->bulk_len + 1] != '\n') {
+                return -6; // Length doesn't match the payload
+            }
+            push_arg(p, p->pos, NULL);
+            p->pos += need; // Move past the string data and the trailing "\r\n"
+            break;
         }
 
-        // Move cursor past the string data and the trailing "\r\n"
-        ptr += str_len + 2;
+        case RESP_ST_BIG:
+            if (p->big_used < (size_t)p->bulk_len + 2) return 0;
+            if (p->big[p->bulk_len] != '\r' || p->big[p->bulk_len + 1] != '\n') {
+                return -6;
+            }
+            push_arg(p, 0, p->big);
+            p->big = NULL;
+            p->big_used = 0;
+            break;
+        }
     }
+}
+
+/*
+ * One-shot wrapper: parse_request
+ * -------------------------------
+ * Parses a frame that must be entirely inside `buf` (e.g. the AOF image).
+ * Same return values as resp_parse; the command needs free_redis_cmd()
+ * only when the return value is > 0.
+ */
+int parse_request(char *buf, size_t len, RedisCmd *cmd) {
+    RespParser p;
+    resp_parser_init(&p, 0);
+
+    int rc = resp_parse(&p, buf, &len, cmd);
 
-    return (ptr - buf); // Success
+    // Views point into buf, so the parser's bookkeeping can go now
+    if (p.args != p.args_inline) mem_free(p.args, p.argc * sizeof(RespArg), MEM_CLIENT_QUERY);
+    return rc;
 }
 
 /*
  * Cleanup Function: free_redis_cmd
  * --------------------------------
- * Frees all memory allocated during parsing.
+ * Arguments are views into the parse buffer, so only a heap argv
+ * (commands wider than RESP_INLINE_ARGS) needs freeing.
  */
 void free_redis_cmd(RedisCmd *cmd) {
-    if (cmd->argv) {
-        for (int i = 0; i < cmd->argc; i++) {
-            if (cmd->argv[i]) {
-                free(cmd->argv[i]); // Free individual strings
-            }
-        }
-        free(cmd->argv); // Free the array of pointers
+    if (cmd->argv && cmd->argv != cmd->argv_inline) {
+        mem_free(cmd->argv, cmd->argc * sizeof(Slice), MEM_CLIENT_QUERY);
     }
+    cmd->argv = cmd->argv_inline;
+    cmd->argc = 0;
 }
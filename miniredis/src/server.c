@@ -4,240 +4,654 @@
 #include "store.h"
 #include "resp.h"
 #include "aof.h" 
+#include "config.h"
+#include "command.h"
+#include "reply.h"
+#include "iothreads.h"
+#include "mem.h"
 #include <ctype.h>
-#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <strings.h> // for strcasecmp
+#include <time.h>
 
 #define PORT "3490" // Default port
+#define MAX_EVENTS 128 // Ready events handled per epoll_wait() call
 
 // Global Key-Value Store
-// Defined in store.c, access via store_get_db()
+// Defined in store.c, sharded; access via store_lock()
+
+// One event loop per thread. Every reactor opens its own listener on the
+// port (SO_REUSEPORT), so the kernel spreads new connections across the
+// threads and a connection stays with the reactor that accepted it.
+// Nothing below touches another reactor's state.
+struct reactor {
+    int id;
+    int listener;
+    int epfd;                          // epoll instance; the listener is registered with a NULL data.ptr
+    struct connection *pending_writes; // Connections with replies queued during this loop iteration
+    long long next_cron_us;
+    int rehashing;                     // Some of our shards are mid-resize
+    pthread_t thread;
+    // Threaded I/O (--io-threads > 1, NULL otherwise)
+    IOPool *io;
+    struct connection *pending_reads;  // Readable clients, read at the top of the next iteration
+    struct connection **io_batch;      // A round's connections, as handed to the pool
+    size_t io_batch_cap;
+};
+
+static struct reactor *reactors;
+static int nreactors;
+static __thread struct reactor *self; // The reactor running on this thread
+
+// --- Command Dispatch ---
+// Live execution and AOF replay share the command table in command.c.
+
+// Monotonic clock in microseconds, for per-command stats
+static long long ustime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-// Network variables
-static int listener;
-static struct pollfd *pfds;
-static int fd_count = 0;
-static int fd_size = 5;
+// --- AOF Replay Handler ---
+// Replays commands from the AOF log when the server starts.
+// Handlers run with a NULL connection, so no responses are sent.
+void replay_command(RedisCmd *cmd) {
+    if (cmd->argc == 0) return;
 
-// --- Helper Functions ---
+    RedisCommand *c = command_lookup(cmd->argv[0].ptr, cmd->argv[0].len);
+    // Only writes change state; anything else in the log is ignored
+    if (!c || !(c->flags & CMD_WRITE) || !command_check_arity(c, cmd->argc)) return;
 
-// Send a simple string response (+OK\r\n)
-void send_simple_string(int fd, const char *msg) {
-    char buf[256];
-    int len = snprintf(buf, sizeof(buf), "+%s\r\n", msg);
-    sendall(fd, buf, &len);
+    c->proc(NULL, cmd);
 }
 
-// Send an error response (-ERR ...\r\n)
-void send_error(int fd, const char *msg) {
-    char buf[256];
-    int len = snprintf(buf, sizeof(buf), "-%s\r\n", msg);
-    sendall(fd, buf, &len);
+// Keys the store expires or evicts are logged as DEL; otherwise a replay
+// would bring back their old value under whatever was written later
+static void log_removed_key(Slice key) {
+    Slice argv[2] = {slice_cstr("DEL"), key};
+    aof_log(2, argv);
 }
 
-// Send a bulk string response ($len\r\nstring\r\n)
-void send_bulk_string(int fd, const char *str) {
-    char buf[1024];
-    if (!str) {
-        // Null Bulk String for non-existent keys ($-1\r\n)
-        int len = sprintf(buf, "$-1\r\n");
-        sendall(fd, buf, &len);
+void server_load_aof(void) {
+    store_set_loading(1);
+    aof_load(replay_command);
+    store_set_loading(0);
+    store_set_removed_hook(log_removed_key);
+}
+
+// --- Main Command Processor ---
+void process_command(struct connection *conn, RedisCmd *cmd) {
+    if (cmd->argc == 0) return;
+
+    RedisCommand *c = command_lookup(cmd->argv[0].ptr, cmd->argv[0].len);
+    if (!c) {
+        printf("Unknown command: %.*s\n", (int)cmd->argv[0].len, cmd->argv[0].ptr);
+        send_error(conn, "ERR unknown command");
         return;
     }
-    int len = snprintf(buf, sizeof(buf), "$%zu\r\n%s\r\n", strlen(str), str);
-    sendall(fd, buf, &len);
-}
 
-// Send an integer response (:num\r\n)
-void send_integer(int fd, int val) {
-    char buf[64];
-    int len = sprintf(buf, ":%d\r\n", val);
-    sendall(fd, buf, &len);
-}
+    if (!command_check_arity(c, cmd->argc)) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "ERR wrong number of arguments for '%s' command", c->name);
+        send_error(conn, msg);
+        command_stat_add(&c->rejected_calls, 1);
+        return;
+    }
 
-// --- AOF Replay Handler ---
-// Replays commands from the AOF log when the server starts.
-// Unlike process_command, this does NOT send responses to a socket.
-void replay_command(RedisCmd *cmd) {
-    if (!cmd->name) return;
+    // Make room before writes; refuse the ones that need memory if that fails
+    if ((c->flags & CMD_WRITE) && store_evict() == -1 && (c->flags & CMD_DENYOOM)) {
+        send_error(conn, "OOM command not allowed when used memory > 'maxmemory'.");
+        command_stat_add(&c->rejected_calls, 1);
+        return;
+    }
 
-    HMap *db = store_get_db();
+    long long start = ustime();
+    c->proc(conn, cmd);
+    command_stat_add(&c->usec, ustime() - start);
+    command_stat_add(&c->calls, 1);
+}
 
-    if (strcasecmp(cmd->name, "SET") == 0) {
-        // Silent insert
-        hmap_insert(db, cmd->argv[1], cmd->argv[2]);
-    } else if (strcasecmp(cmd->name, "DEL") == 0) {
-        // Silent delete
-        hmap_delete(db, cmd->argv[1]);
+// Close a client connection and release its state
+static void close_connection(struct connection *conn) {
+    if (conn->pending_write) {
+        // Unlink from the pending-writes list (only this iteration's clients)
+        struct connection **from = &self->pending_writes;
+        while (*from != conn) from = &(*from)->next;
+        *from = conn->next;
+    }
+    if (conn->pending_read) {
+        struct connection **from = &self->pending_reads;
+        while (*from != conn) from = &(*from)->next_read;
+        *from = conn->next_read;
     }
-    // GET and PING are ignored during replay
+    conn_unwatch(self->epfd, conn);
+    close(conn->fd);
+    conn_free(conn);
 }
 
-// --- Main Command Processor ---
-void process_command(int fd, RedisCmd *cmd) {
-    if (cmd->argc == 0) return;
-    if (!cmd->name) return;
+// Accept new incoming connections
+// The listener is edge-triggered, so keep accepting until the backlog is empty.
+void handle_new_connection() {
+    for (;;) {
+        struct sockaddr_storage remoteaddr;
+        socklen_t addrlen = sizeof remoteaddr;
 
-    HMap *db = store_get_db();
+        int newfd = accept(self->listener, (struct sockaddr *)&remoteaddr, &addrlen);
 
-    // --- SET Command ---
-    if (strcasecmp(cmd->name, "SET") == 0) {
-        if (cmd->argc != 3) {
-            send_error(fd, "ERR wrong number of arguments for 'set' command");
-            return;
-        }
-        
-        // 1. Apply to in-memory database
-        hmap_insert(db, cmd->argv[1], cmd->argv[2]);
-        
-        // 2. Persist to Disk (AOF)
-        aof_log(cmd->argc, cmd->argv);
-        aof_sync(); // Force fsync to ensure durability
-
-        // 3. Send response to client
-        send_simple_string(fd, "OK");
-
-    // --- GET Command ---
-    } else if (strcasecmp(cmd->name, "GET") == 0) {
-        if (cmd->argc != 2) {
-            send_error(fd, "ERR wrong number of arguments for 'get' command");
+        if (newfd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
             return;
         }
-        HNode *node = hmap_lookup(db, cmd->argv[1]);
-        if (node) {
-            send_bulk_string(fd, node->value);
-        } else {
-            send_bulk_string(fd, NULL);
+
+        set_nonblocking(newfd);
+        set_nodelay(newfd);
+
+        struct connection *conn = conn_create(newfd);
+        if (!conn) {
+            fprintf(stderr, "out of memory creating connection\n");
+            close(newfd);
+            continue;
         }
 
-    // --- DEL Command ---
-    } else if (strcasecmp(cmd->name, "DEL") == 0) {
-        if (cmd->argc != 2) {
-            send_error(fd, "ERR wrong number of arguments for 'del' command");
-            return;
+        if (conn_watch(self->epfd, conn, EPOLLIN) == -1) {
+            perror("epoll_ctl");
+            close(newfd);
+            conn_free(conn);
+            continue;
         }
-        
-        // 1. Apply to in-memory database
-        int deleted = hmap_delete(db, cmd->argv[1]);
-        
-        // 2. Persist to Disk (AOF)
-        if (deleted) {
-             aof_log(cmd->argc, cmd->argv);
-             aof_sync();
+        printf("New connection on socket %d (thread %d)\n", newfd, self->id);
+    }
+}
+
+// Enforce the client output buffer limits.
+// Returns -1 (and marks the connection) if the client must be dropped.
+static int check_output_limits(struct connection *conn) {
+    if (conn->close_asap) return -1; // A reply could not be queued
+
+    const struct server_config *cfg = config_get();
+    size_t used = conn_output_size(conn);
+
+    if (cfg->obuf_hard_limit && used > cfg->obuf_hard_limit) {
+        printf("Client on socket %d over output hard limit (%zu bytes), closing\n",
+               conn->fd, used);
+        conn->close_asap = 1;
+        return -1;
+    }
+
+    if (cfg->obuf_soft_limit && used > cfg->obuf_soft_limit) {
+        time_t now = time(NULL);
+        if (conn->obuf_soft_since == 0) {
+            conn->obuf_soft_since = now;
+        } else if (now - conn->obuf_soft_since >= cfg->obuf_soft_seconds) {
+            printf("Client on socket %d over output soft limit for %ds, closing\n",
+                   conn->fd, (int)(now - conn->obuf_soft_since));
+            conn->close_asap = 1;
+            return -1;
         }
+    } else {
+        conn->obuf_soft_since = 0;
+    }
+    return 0;
+}
+
+// Remember that this connection has replies to flush this iteration
+static void queue_pending_write(struct connection *conn) {
+    if (conn->pending_write || !conn_has_pending_output(conn)) return;
+    conn->pending_write = 1;
+    conn->next = self->pending_writes;
+    self->pending_writes = conn;
+}
+
+// Remember that this connection has input to read (I/O threads only)
+static void queue_pending_read(struct connection *conn) {
+    if (conn->pending_read) return;
+    conn->pending_read = 1;
+    conn->next_read = self->pending_reads;
+    self->pending_reads = conn;
+}
 
-        // 3. Send response to client
-        send_integer(fd, deleted);
+// Make room for n connections in the reactor's I/O batch
+static int reserve_batch(size_t n) {
+    if (n <= self->io_batch_cap) return 0;
+    size_t cap = self->io_batch_cap ? self->io_batch_cap * 2 : 64;
+    while (cap < n) cap *= 2;
+    struct connection **batch = realloc(self->io_batch, cap * sizeof(*batch));
+    if (!batch) return -1;
+    self->io_batch = batch;
+    self->io_batch_cap = cap;
+    return 0;
+}
 
-    // --- PING Command ---
-    } else if (strcasecmp(cmd->name, "PING") == 0) {
-        send_simple_string(fd, "PING A RAI KUB");
+// Waking the I/O threads only pays off with a few clients for each
+static int use_io_threads(size_t n) {
+    return self->io && n >= 2 * (size_t)io_pool_size(self->io);
+}
 
+// Act on the result of conn_flush(): close on error, otherwise arm or
+// disarm EPOLLOUT depending on whether the socket took everything.
+// Returns -1 if the connection was closed.
+static int write_done(struct connection *conn, int rv) {
+    if (rv == -1) {
+        close_connection(conn);
+        return -1;
+    }
+
+    if (rv == 0) {
+        if (check_output_limits(conn) == -1) {
+            close_connection(conn);
+            return -1;
+        }
+        if (!conn->want_write) {
+            conn_rewatch(self->epfd, conn, EPOLLIN | EPOLLOUT);
+            conn->want_write = 1;
+        }
     } else {
-        printf("Unknown command: %s\n", cmd->name);
-        send_error(fd, "ERR unknown command");
+        conn->obuf_soft_since = 0;
+        if (conn->want_write) {
+            conn_rewatch(self->epfd, conn, EPOLLIN);
+            conn->want_write = 0;
+        }
     }
+    return 0;
 }
 
-// Accept a new incoming connection
-void handle_new_connection() {
-    struct sockaddr_storage remoteaddr;
-    socklen_t addrlen = sizeof remoteaddr;
+// Write as much queued output as the socket takes without blocking.
+// Whatever is left stays queued and EPOLLOUT tells us when to continue,
+// so a slow reader never stalls the other clients.
+// Returns -1 if the connection was closed.
+static int write_to_client(struct connection *conn) {
+    int rv = conn_flush(conn);
+    if (rv == -1) perror("writev");
+    return write_done(conn, rv);
+}
 
-    int newfd = accept(listener, (struct sockaddr *)&remoteaddr, &addrlen);
+// Flush replies for every connection touched in this loop iteration.
+// Called once before going back to epoll_wait, so a batch of pipelined
+// replies costs a single writev() instead of one send() per reply.
+// With I/O threads the writev() calls are spread over the pool.
+static void handle_pending_writes(void) {
+    size_t n = 0;
+    while (self->pending_writes) {
+        struct connection *conn = self->pending_writes;
+        self->pending_writes = conn->next;
+        conn->pending_write = 0;
+        conn->next = NULL;
+
+        // Already waiting on EPOLLOUT: the socket is full, don't bother
+        if (conn->want_write) continue;
+        if (self->io && reserve_batch(n + 1) == 0) {
+            self->io_batch[n++] = conn;
+        } else {
+            write_to_client(conn);
+        }
+    }
 
-    if (newfd == -1) {
-        perror("accept");
+    if (use_io_threads(n)) {
+        io_pool_write(self->io, self->io_batch, n);
+        for (size_t i = 0; i < n; i++) {
+            write_done(self->io_batch[i], self->io_batch[i]->io_status);
+        }
     } else {
-        add_to_pfds(&pfds, newfd, &fd_count, &fd_size);
-        printf("New connection on socket %d\n", newfd);
+        for (size_t i = 0; i < n; i++) write_to_client(self->io_batch[i]);
+    }
+}
+
+// Execute every complete frame in the read buffer.
+// A trailing partial frame stays in rbuf (and its progress in conn->parser)
+// until the next read completes it.
+// Returns -1 on a protocol error, 0 otherwise.
+static int process_input(struct connection *conn) {
+    size_t pos = 0;
+
+    while (pos < conn->rbuf_used) {
+        RedisCmd cmd;
+        size_t avail = conn->rbuf_used - pos;
+        int consumed = resp_parse(&conn->parser, conn->rbuf + pos, &avail, &cmd);
+
+        if (consumed == 0) {
+            // Incomplete frame, wait for more data. A large bulk string may
+            // have been moved out of rbuf into its own buffer.
+            conn->rbuf_used = pos + avail;
+            break;
+        }
+        if (consumed < 0) {
+            printf("Protocol error on socket %d\n", conn->fd);
+            send_error(conn, "ERR Protocol error");
+            return -1;
+        }
+
+        process_command(conn, &cmd);
+        free_redis_cmd(&cmd);
+        resp_parser_reset(&conn->parser);
+        pos += consumed;
+
+        if (check_output_limits(conn) == -1) return -1;
     }
+
+    conn_consume_rbuf(conn, pos);
+    return 0;
 }
 
 // Handle incoming data from an existing client
-void handle_client_data(int i) {
-    char buf[4096]; // 4KB Buffer
-    int sender_fd = pfds[i].fd;
+// Edge-triggered: read until recv() reports EAGAIN or we would miss data.
+// Returns -1 if the connection was closed.
+int handle_client_data(struct connection *conn) {
+    int sender_fd = conn->fd;
+
+    for (;;) {
+        // A large bulk string in flight is read straight into its own
+        // buffer; everything else goes through rbuf.
+        size_t room;
+        char *dest = resp_parser_bulk_dest(&conn->parser, &room);
+        int direct = dest != NULL;
+
+        if (!direct) {
+            if (conn_reserve_rbuf(conn, 4096) == -1) {
+                printf("Query buffer limit reached on socket %d\n", sender_fd);
+                close_connection(conn);
+                return -1;
+            }
+            // Leave room for the NUL terminator kept after the data
+            dest = conn->rbuf + conn->rbuf_used;
+            room = conn->rbuf_size - conn->rbuf_used - 1;
+        }
 
-    int nbytes = recv(sender_fd, buf, sizeof(buf) - 1, 0);
+        ssize_t nbytes = recv(sender_fd, dest, room, 0);
 
-    if (nbytes <= 0) {
-        if (nbytes == 0) {
-            printf("Socket %d hung up\n", sender_fd);
+        if (nbytes <= 0) {
+            if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break; // Socket drained
+            }
+            if (nbytes == 0) {
+                printf("Socket %d hung up\n", sender_fd);
+            } else {
+                perror("recv");
+            }
+            close_connection(conn);
+            return -1;
+        }
+
+        if (direct) {
+            resp_parser_bulk_filled(&conn->parser, nbytes);
+            if (resp_parser_bulk_dest(&conn->parser, &room)) continue; // Still filling
         } else {
-            perror("recv");
+            conn->rbuf_used += nbytes;
+            conn->rbuf[conn->rbuf_used] = '\0'; // Null-terminate string
         }
-        close(sender_fd);
-        del_from_pfds(pfds, i, &fd_count);
-    } else {
-        buf[nbytes] = '\0'; // Null-terminate string
-        
+
+        if (process_input(conn) == -1) {
+            if (!conn->close_asap) conn_flush(conn); // Best effort: let the client see the error
+            close_connection(conn);
+            return -1;
+        }
+    }
+
+    queue_pending_write(conn);
+    return 0;
+}
+
+// Run the commands an I/O thread parsed for this client, in order, then
+// act on how its read ended
+static void finish_read(struct connection *conn) {
+    if (conn->io_status == IO_READ_DEFER) {
+        handle_client_data(conn);
+        return;
+    }
+
+    for (size_t i = 0; i < conn->io_ncmds; i++) {
         RedisCmd cmd;
-        // Parse the RESP request
-        int processed = parse_request(buf, nbytes, &cmd);
-        
-        // If parsing is successful, process the command
-        if (processed >= 0) { 
-            process_command(sender_fd, &cmd);
-            free_redis_cmd(&cmd);
+        io_pool_command(self->io, conn, i, &cmd);
+        process_command(conn, &cmd);
+        if (check_output_limits(conn) == -1) {
+            close_connection(conn);
+            return;
+        }
+    }
+    conn_consume_rbuf(conn, conn->io_parsed);
+
+    int rv = 0;
+    if (conn->io_status == IO_READ_PROTO) {
+        printf("Protocol error on socket %d\n", conn->fd);
+        send_error(conn, "ERR Protocol error");
+        rv = -1;
+    } else if (conn->io_status != IO_READ_CLOSED) {
+        // Whatever the thread left: frames it had no room for, or a
+        // large bulk string that should now be read directly
+        rv = process_input(conn);
+    }
+    if (rv == -1) {
+        if (!conn->close_asap) conn_flush(conn); // Best effort: let the client see the error
+        close_connection(conn);
+        return;
+    }
+    if (conn->io_status == IO_READ_CLOSED) {
+        close_connection(conn);
+        return;
+    }
+
+    if (conn->io_status == IO_READ_MORE) queue_pending_read(conn);
+    queue_pending_write(conn);
+}
+
+// Read from the clients that became readable: recv() and parsing go to
+// the I/O threads when enough clients are ready, commands always run here
+static void handle_pending_reads(void) {
+    size_t n = 0;
+    while (self->pending_reads) {
+        struct connection *conn = self->pending_reads;
+        self->pending_reads = conn->next_read;
+        conn->pending_read = 0;
+        conn->next_read = NULL;
+
+        if (reserve_batch(n + 1) == 0) {
+            self->io_batch[n++] = conn;
         } else {
-             printf("Protocol error or incomplete data\n");
-             // Optional: send_error(sender_fd, "ERR processing request"); 
+            handle_client_data(conn);
         }
     }
+
+    if (use_io_threads(n)) {
+        io_pool_read(self->io, self->io_batch, n);
+        for (size_t i = 0; i < n; i++) finish_read(self->io_batch[i]);
+    } else {
+        for (size_t i = 0; i < n; i++) handle_client_data(self->io_batch[i]);
+    }
+}
+
+// Listener and epoll instance of one reactor
+static void reactor_init(struct reactor *r, int id, const char *port) {
+    r->id = id;
+    r->pending_writes = NULL;
+    r->next_cron_us = 0;
+    r->rehashing = 0;
+    r->pending_reads = NULL;
+    r->io_batch = NULL;
+    r->io_batch_cap = 0;
+    r->io = NULL;
+    if (config_get()->io_threads > 1) {
+        r->io = io_pool_create(config_get()->io_threads);
+        if (!r->io) {
+            fprintf(stderr, "out of memory creating I/O threads\n");
+            exit(1);
+        }
+    }
+
+    r->listener = get_listener_socket(port, config_get()->threads > 1);
+    if (r->listener == -1) {
+        fprintf(stderr, "error getting listener socket\n");
+        exit(1);
+    }
+    set_nonblocking(r->listener);
+
+    r->epfd = epoll_create1(0);
+    if (r->epfd == -1) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // NULL marks the listener
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listener, &ev) == -1) {
+        perror("epoll_ctl");
+        exit(1);
+    }
 }
 
 void server_init(const char *port)
 {
-    // 1. Initialize the Key-Value Store
+    // 1. Initialize the Key-Value Store and the protocol parser
     store_init();
+    const struct server_config *cfg = config_get();
+    store_set_maxmemory(cfg->maxmemory, cfg->maxmemory_policy, cfg->maxmemory_samples);
+    resp_init();
+    command_table_init();
     
     // 2. Initialize AOF System & Recover Data
     printf("[AOF] Initializing AOF system...\n");
     aof_init("database.aof");
     
     printf("[AOF] Restoring data from disk...\n");
-    aof_load(replay_command); // Replay log to restore state
+    server_load_aof(); // Replay log to restore state
     printf("[AOF] Data loaded successfully.\n");
 
-    // 3. Setup Network Listener
-    listener = get_listener_socket(port);
-    if (listener == -1) {
-        fprintf(stderr, "error getting listener socket\n");
+    // 3. One listener and epoll instance per reactor thread
+    nreactors = cfg->threads;
+    reactors = calloc(nreactors, sizeof(*reactors));
+    if (!reactors) {
+        perror("calloc");
         exit(1);
     }
-    
-    // Initialize pollfds array
-    pfds = malloc(sizeof *pfds * fd_size);
-    pfds[0].fd = listener;
-    pfds[0].events = POLLIN; // Monitor listener for new connections
-    fd_count = 1;
+    for (int i = 0; i < nreactors; i++) {
+        reactor_init(&reactors[i], i, port);
+    }
+
+    // With one thread the lock is never contended, and in-place updates
+    // (which lock-free reads rule out) are worth more
+    int lockfree = nreactors > 1 && store_enable_lockfree_reads();
 
-    printf("Server initialized on port %s\n", port);
+    printf("Server initialized on port %s (%d thread%s%s", port, nreactors,
+           nreactors == 1 ? "" : "s", lockfree ? ", lock-free reads" : "");
+    if (cfg->io_threads > 1) printf(", %d I/O threads each", cfg->io_threads);
+    printf(")\n");
 }
 
-void server_run() {
-    printf("Server running...\n");
-    for(;;) {
-        int poll_count = poll(pfds, fd_count, -1);
+// Spend up to 1ms of idle time moving buckets of our shards' tables
+static void idle_rehash(void) {
+    self->rehashing = store_rehash(self->id, nreactors, 1000);
+}
 
-        if (poll_count == -1) {
-            perror("poll");
+// --- Periodic Tasks ---
+#define CRON_INTERVAL_MS 100   // Run the cron this often
+#define EXPIRE_BUDGET_US 25000 // Active expiry gets at most 25% of each interval
+#define TRIM_MIN_BYTES (8 << 20) // Drop in used memory worth trimming the heap for
+
+// Freed memory (nodes, empty slab pages) stays in the malloc heap; return
+// it to the system once usage has fallen this far below its high point
+// since the last trim
+static void trim_memory(void) {
+    static size_t high;
+    size_t used = mem_used_total();
+    if (used > high) high = used;
+    if (high - used >= TRIM_MIN_BYTES) {
+        mem_trim();
+        high = used;
+    }
+}
+
+// Periodic housekeeping: advance the eviction clock and trim the heap
+// (one thread does both for all), sample keys with a TTL in our shards
+// (keys nobody reads never hit lazy expiry), and free what lock-free
+// readers have let go of
+static void server_cron(void) {
+    if (self->id == 0) {
+        store_tick();
+        trim_memory();
+    }
+    store_expire_cycle(self->id, nreactors, EXPIRE_BUDGET_US);
+    store_reclaim(self->id, nreactors);
+    // Notice resizes started by writes on any thread (no time spent here)
+    self->rehashing = store_rehash(self->id, nreactors, 0);
+}
+
+// Milliseconds epoll_wait may sleep before the cron is due (runs it if it is)
+static int cron_timeout(void) {
+    long long now = ustime();
+    if (now >= self->next_cron_us) {
+        server_cron();
+        self->next_cron_us = now + CRON_INTERVAL_MS * 1000;
+    }
+    return (int)((self->next_cron_us - now + 999) / 1000);
+}
+
+static void *reactor_main(void *arg) {
+    struct epoll_event events[MAX_EVENTS];
+    self = arg;
+    store_thread_init();
+
+    for(;;) {
+        handle_pending_reads();
+        handle_pending_writes();
+
+        // Sleep until the next cron tick at most, and not at all while a
+        // resize is in progress (idle time finishes it) or a client still
+        // has input we stopped reading
+        int timeout = cron_timeout();
+        if (self->rehashing || self->pending_reads) timeout = 0;
+
+        // Only ready descriptors come back, so a wakeup costs O(ready)
+        // instead of O(connections).
+        int n = epoll_wait(self->epfd, events, MAX_EVENTS, timeout);
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             exit(1);
         }
+        if (n == 0) {
+            idle_rehash();
+            continue;
+        }
 
-        for(int i = 0; i < fd_count; i++) {
-            if (pfds[i].revents & POLLIN) {
-                if (pfds[i].fd == listener) {
-                    handle_new_connection();
-                } else {
-                    handle_client_data(i);
+        for (int i = 0; i < n; i++) {
+            struct connection *conn = events[i].data.ptr;
+            uint32_t ev = events[i].events;
+            if (conn == NULL) {
+                handle_new_connection();
+                continue;
+            }
+            if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (self->io) {
+                    queue_pending_read(conn); // Batched for the I/O threads
+                } else if (handle_client_data(conn) == -1) {
+                    continue; // Closed
                 }
             }
+            if ((ev & EPOLLOUT) && conn->want_write) {
+                write_to_client(conn);
+            }
         }
     }
-}
\ No newline at end of file
+    return NULL;
+}
+
+// Reactor 0 runs on the calling thread
+void server_run() {
+    printf("Server running...\n");
+    for (int i = 1; i < nreactors; i++) {
+        int rv = pthread_create(&reactors[i].thread, NULL, reactor_main, &reactors[i]);
+        if (rv != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+            exit(1);
+        }
+    }
+    reactor_main(&reactors[0]);
+}
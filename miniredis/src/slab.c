@@ -0,0 +1,211 @@
+#include <stdint.h> // uintptr_t
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+#include "mem.h"
+
+#define SLAB_GROWTH 1.25 // Each class is about this much bigger than the last
+
+// used_bytes and large_bytes may be polled without the owner's lock:
+// the owner updates them with relaxed atomic stores
+static inline void counter_add(size_t *counter, size_t delta) {
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+static size_t align_up(size_t n) {
+    return (n + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+}
+
+// Build the size classes (48, 64, 80, 112, 144, ... 4096) and the table
+// that maps a request size straight to its class.
+void slab_init(Slab *slab, int paged) {
+    memset(slab, 0, sizeof(*slab));
+    slab->paged = paged;
+
+    size_t size = SLAB_MIN_CHUNK;
+    for (;;) {
+        slab->classes[slab->nclasses++].size = size;
+        if (size == SLAB_MAX_CHUNK) break;
+        size_t next = align_up((size_t)(size * SLAB_GROWTH));
+        if (next > SLAB_MAX_CHUNK || slab->nclasses == SLAB_MAX_CLASSES - 1) {
+            next = SLAB_MAX_CHUNK;
+        }
+        size = next;
+    }
+
+    int c = 0;
+    for (size_t units = 0; units <= SLAB_MAX_CHUNK / SLAB_ALIGN; units++) {
+        while (slab->classes[c].size < units * SLAB_ALIGN) c++;
+        slab->class_of[units] = (unsigned char)c;
+    }
+}
+
+// Index of the smallest class that fits `size` (<= SLAB_MAX_CHUNK)
+static int class_index(const Slab *slab, size_t size) {
+    return slab->class_of[(size + SLAB_ALIGN - 1) / SLAB_ALIGN];
+}
+
+size_t slab_block_size(const Slab *slab, size_t size) {
+    if (size > SLAB_MAX_CHUNK || !slab->paged) return align_up(size);
+    return slab->classes[class_index(slab, size)].size;
+}
+
+// Chunks start after the page header
+#define PAGE_HEADER ((sizeof(SlabPage) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+static inline SlabPage *page_of(void *chunk) {
+    return (SlabPage *)((uintptr_t)chunk & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+static inline int page_has_room(const SlabPage *page) {
+    return page->free_list || page->fresh_left;
+}
+
+static void partial_push(SlabClass *cls, SlabPage *page) {
+    page->prev = NULL;
+    page->next = cls->partial;
+    if (cls->partial) cls->partial->prev = page;
+    cls->partial = page;
+}
+
+static void partial_remove(SlabClass *cls, SlabPage *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        cls->partial = page->next;
+    }
+    if (page->next) page->next->prev = page->prev;
+}
+
+static SlabPage *page_new(Slab *slab, int c) {
+    SlabPage *page = mem_aligned_alloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE, MEM_NODES);
+    if (!page) return NULL;
+    SlabClass *cls = &slab->classes[c];
+    page->free_list = NULL;
+    // Cut chunks from the page lazily, so a new page costs no setup pass
+    page->fresh = (char *)page + PAGE_HEADER;
+    page->fresh_left = (SLAB_PAGE_SIZE - PAGE_HEADER) / cls->size;
+    page->used = 0;
+    page->cls = c;
+    cls->pages++;
+    return page;
+}
+
+void *slab_alloc(Slab *slab, size_t size) {
+    if (size > SLAB_MAX_CHUNK || !slab->paged) {
+        void *ptr = mem_malloc(align_up(size), MEM_NODES);
+        if (ptr) {
+            counter_add(&slab->large_bytes, align_up(size));
+            slab->large_count++;
+        }
+        return ptr;
+    }
+
+    int c = class_index(slab, size);
+    SlabClass *cls = &slab->classes[c];
+    SlabPage *page = cls->partial;
+    if (!page) {
+        page = page_new(slab, c);
+        if (!page) return NULL;
+        partial_push(cls, page);
+    }
+
+    void *ptr;
+    if (page->free_list) {
+        // Reuse the most recently freed chunk (likely still in cache)
+        ptr = page->free_list;
+        page->free_list = *(void **)ptr;
+    } else {
+        ptr = page->fresh;
+        page->fresh += cls->size;
+        page->fresh_left--;
+    }
+    page->used++;
+    if (!page_has_room(page)) partial_remove(cls, page);
+
+    cls->used++;
+    counter_add(&slab->used_bytes, cls->size);
+    return ptr;
+}
+
+// `size` must be what slab_alloc was called with (or slab_block_size of it)
+void slab_free(Slab *slab, void *ptr, size_t size) {
+    if (!ptr) return;
+#ifdef SLAB_POISON
+    memset(ptr, SLAB_POISON_BYTE, size);
+#endif
+    if (size > SLAB_MAX_CHUNK || !slab->paged) {
+        counter_add(&slab->large_bytes, -align_up(size));
+        slab->large_count--;
+        mem_free(ptr, align_up(size), MEM_NODES);
+        return;
+    }
+
+    SlabPage *page = page_of(ptr);
+    SlabClass *cls = &slab->classes[page->cls];
+    if (!page_has_room(page)) partial_push(cls, page); // Was full
+    *(void **)ptr = page->free_list;
+    page->free_list = ptr;
+    page->used--;
+    cls->used--;
+    counter_add(&slab->used_bytes, -cls->size);
+
+    // Release an empty page, but keep the class's last one with room
+    if (page->used == 0 && (page->prev || page->next)) {
+        partial_remove(cls, page);
+        cls->pages--;
+        slab->pages_released++;
+        mem_free(page, SLAB_PAGE_SIZE, MEM_NODES);
+    }
+}
+
+void slab_get_stats(const Slab *slab, SlabStats *st) {
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < slab->nclasses; i++) {
+        const SlabClass *cls = &slab->classes[i];
+        st->page_bytes += cls->pages * SLAB_PAGE_SIZE;
+        st->used_bytes += cls->used * cls->size;
+    }
+    st->free_bytes = st->page_bytes - st->used_bytes;
+    st->large_bytes = slab->large_bytes;
+    st->frag_ratio = st->used_bytes ? (double)st->page_bytes / st->used_bytes : 1.0;
+}
+
+void slab_merge_stats(Slab *into, const Slab *from) {
+    for (int i = 0; i < from->nclasses; i++) {
+        into->classes[i].pages += from->classes[i].pages;
+        into->classes[i].used += from->classes[i].used;
+    }
+    into->used_bytes += from->used_bytes;
+    into->large_bytes += from->large_bytes;
+    into->large_count += from->large_count;
+    into->pages_released += from->pages_released;
+}
+
+size_t slab_stats_info(const Slab *slab, char *buf, size_t size) {
+    SlabStats st;
+    slab_get_stats(slab, &st);
+
+    size_t len = snprintf(buf, size,
+                          "# Allocator\r\n"
+                          "slab_page_bytes:%zu\r\n"
+                          "slab_used_bytes:%zu\r\n"
+                          "slab_free_bytes:%zu\r\n"
+                          "slab_large_bytes:%zu\r\n"
+                          "slab_large_blocks:%zu\r\n"
+                          "slab_fragmentation_ratio:%.2f\r\n"
+                          "slab_pages_released:%zu\r\n",
+                          st.page_bytes, st.used_bytes, st.free_bytes,
+                          st.large_bytes, slab->large_count, st.frag_ratio,
+                          slab->pages_released);
+    // One line per class in use
+    for (int i = 0; i < slab->nclasses && len < size; i++) {
+        const SlabClass *cls = &slab->classes[i];
+        if (cls->pages == 0) continue;
+        len += snprintf(buf + len, size - len, "slab_class_%zu:pages=%zu,used=%zu,free=%zu\r\n",
+                        cls->size, cls->pages, cls->used,
+                        cls->pages * ((SLAB_PAGE_SIZE - PAGE_HEADER) / cls->size) - cls->used);
+    }
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,163 @@
+#include <math.h>  // isnan
+#include <stdio.h> // snprintf
+#include <stdlib.h> // strtod
+#include "slice.h"
+
+int slice_to_int64(Slice s, int64_t *out) {
+    const char *p = s.ptr;
+    size_t len = s.len;
+    int neg = 0;
+
+    if (len == 0 || len > 20) return 0;
+    if (p[0] == '-') {
+        neg = 1;
+        p++;
+        len--;
+        if (len == 0) return 0;
+    }
+    if (p[0] == '0') {
+        // Only "0" itself (not "-0", "007")
+        if (len == 1 && !neg) {
+            *out = 0;
+            return 1;
+        }
+        return 0;
+    }
+
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned d = (unsigned char)p[i] - '0';
+        if (d > 9) return 0;
+        if (v > (UINT64_MAX - d) / 10) return 0;
+        v = v * 10 + d;
+    }
+
+    if (neg) {
+        if (v > (uint64_t)INT64_MAX + 1) return 0;
+        *out = (v == (uint64_t)INT64_MAX + 1) ? INT64_MIN : -(int64_t)v;
+    } else {
+        if (v > (uint64_t)INT64_MAX) return 0;
+        *out = (int64_t)v;
+    }
+    return 1;
+}
+
+size_t int64_to_chars(int64_t v, char *buf) {
+    char tmp[INT64_STR_MAX];
+    char *p = tmp + sizeof(tmp);
+    uint64_t u = v < 0 ? 0ULL - (uint64_t)v : (uint64_t)v;
+
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) *--p = '-';
+
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+int slice_to_double(Slice s, double *out) {
+    char buf[DOUBLE_STR_MAX + 32];
+    if (s.len == 0 || s.len >= sizeof(buf)) return 0;
+    memcpy(buf, s.ptr, s.len); // strtod needs a terminator
+    buf[s.len] = '\0';
+    if (buf[0] == ' ' || buf[0] == '\t') return 0;
+
+    char *end;
+    double v = strtod(buf, &end);
+    if (end != buf + s.len || isnan(v)) return 0;
+    *out = v;
+    return 1;
+}
+
+size_t double_to_chars(double v, char *buf) {
+    if (isinf(v)) {
+        memcpy(buf, v > 0 ? "inf" : "-inf", v > 0 ? 3 : 4);
+        return v > 0 ? 3 : 4;
+    }
+    // The fewest digits that still read back as v (1.1, not 1.1000000000000001)
+    char tmp[DOUBLE_STR_MAX];
+    int len = 0;
+    for (int prec = 15; prec <= 17; prec++) {
+        len = snprintf(tmp, sizeof(tmp), "%.*g", prec, v);
+        if (strtod(tmp, NULL) == v) break;
+    }
+    memcpy(buf, tmp, len);
+    return len;
+}
+
+// One pattern element at p (anything but '*') against the byte c.
+// Sets *next just past the element.
+static int glob_element(const char *p, const char *pend, unsigned char c, const char **next) {
+    if (*p == '?') {
+        *next = p + 1;
+        return 1;
+    }
+    if (*p == '\\' && p + 1 < pend) {
+        *next = p + 2;
+        return (unsigned char)p[1] == c;
+    }
+    if (*p != '[') {
+        *next = p + 1;
+        return (unsigned char)*p == c;
+    }
+
+    // [abc], [^abc], [a-z], with \ escaping inside
+    const char *q = p + 1;
+    int negate = 0, hit = 0;
+    if (q < pend && *q == '^') {
+        negate = 1;
+        q++;
+    }
+    while (q < pend && *q != ']') {
+        if (*q == '\\' && q + 1 < pend) {
+            hit |= (unsigned char)q[1] == c;
+            q += 2;
+        } else if (q + 2 < pend && q[1] == '-' && q[2] != ']') {
+            unsigned char lo = q[0], hi = q[2];
+            if (lo > hi) {
+                unsigned char t = lo;
+                lo = hi;
+                hi = t;
+            }
+            hit |= c >= lo && c <= hi;
+            q += 3;
+        } else {
+            hit |= (unsigned char)*q == c;
+            q++;
+        }
+    }
+    *next = q < pend ? q + 1 : q; // An unclosed class runs to the end
+    return hit != negate;
+}
+
+// Every element but '*' matches one byte, so on a mismatch it is enough
+// to let the last '*' swallow one more byte and retry from there
+int slice_glob_match(Slice pattern, Slice s) {
+    const char *p = pattern.ptr, *pend = p + pattern.len;
+    const char *str = s.ptr, *send = str + s.len;
+    const char *star_p = NULL, *star_s = NULL;
+
+    while (str < send) {
+        if (p < pend && *p == '*') {
+            while (p < pend && *p == '*') p++;
+            if (p == pend) return 1; // Trailing '*' takes the rest
+            star_p = p;
+            star_s = str;
+            continue;
+        }
+        const char *next;
+        if (p < pend && glob_element(p, pend, (unsigned char)*str, &next)) {
+            p = next;
+            str++;
+            continue;
+        }
+        if (!star_p) return 0;
+        p = star_p;
+        str = ++star_s;
+    }
+    while (p < pend && *p == '*') p++;
+    return p == pend;
+}
@@ -1,167 +1,1639 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
 #include "../include/store.h"
+#include "../include/slab.h"
+#include "../include/mem.h"
+#include "../include/epoch.h"
+#include "../include/zset.h"
+
+#ifdef HMAP_SWISS
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#endif
 
 // Initial size
 #define K_INITIAL_SIZE 4 
 
 // --- Helper Functions ---
 
-// FNV-1a Hash Function (Standard, more popular than djb2 for production)
-static uint64_t str_hash(const char *data) {
-    uint64_t h = 0xcbf29ce484222325;
-    const char *p = data;
-    while (*p) {
-        h = (h ^ (unsigned char)*p) * 0x100000001b3;
-        p++;
-    }
-    return h;
-}
-
-// Table expansion function (The Core Logic)
-static void hmap_resize(HMap *hmap) {
-    // 1. Calculate new size (double it)
-    size_t new_size = hmap->size ? hmap->size * 2 : K_INITIAL_SIZE;
-    
-    // 2. Allocate new table (Pointer Array)
-    HNode **new_tab = calloc(new_size, sizeof(HNode *));
-    if (!new_tab) return; // Out of memory handling (should be handled better in production)
-
-    size_t new_mask = new_size - 1;
-
-    // 3. Move old data to new home (Rehashing)
-    // Here we don't malloc/free Nodes, we just "move Pointers"
-    for (size_t i = 0; i < hmap->size; ++i) {
-        HNode *node = hmap->tab[i];
-        while (node) {
-            HNode *next = node->next; // Remember next node
-            
-            // Calculate new position: (hcode & new_mask)
-            // Tech tip: Using & mask is much faster than % size (but size must be 2^N)
-            size_t pos = node->hcode & new_mask;
-            
-            // Insert at head of new table
-            node->next = new_tab[pos];
-            new_tab[pos] = node;
-            
-            node = next; // Move to next node
-        }
-    }
-
-    // 4. Discard old table and switch to new one
-    free(hmap->tab);
-    hmap->tab = new_tab;
-    hmap->size = new_size;
-    hmap->mask = new_mask;
+// Keyed hash in the style of wyhash: 8 (or 4) bytes per step, each step
+// one 64x64->128-bit multiply folded back to 64 bits. The seed is random
+// per process, so clients can't precompute keys that all land in one
+// bucket. Length-driven, so keys may contain '\0'.
+static uint64_t g_hash_seed;
+
+#define WYP0 0x2d358dccaa6c78a5ull
+#define WYP1 0x8bb84b93962eacc9ull
+#define WYP2 0x4b33a62ed433d4a3ull
+#define WYP3 0x4d5a2da51de1aa47ull
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// Unaligned little-endian loads (memcpy compiles to a single mov)
+static inline uint64_t wy_r8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint64_t wy_r4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static uint64_t str_hash(const char *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t seed = g_hash_seed;
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two overlapping 4-byte reads from each end cover 4..16 bytes
+            size_t mid = (len >> 3) << 2;
+            a = (wy_r4(p) << 32) | wy_r4(p + mid);
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            // Three independent lanes keep the multiplier busy on long keys
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ WYP1, wy_r8(p + 8) ^ seed);
+                s1 = wy_mix(wy_r8(p + 16) ^ WYP2, wy_r8(p + 24) ^ s1);
+                s2 = wy_mix(wy_r8(p + 32) ^ WYP3, wy_r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ WYP1, wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // Last 16 bytes (may overlap what was already mixed)
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+
+    __uint128_t r = (__uint128_t)(a ^ WYP1) * (b ^ seed);
+    return wy_mix((uint64_t)r ^ WYP0 ^ len, (uint64_t)(r >> 64) ^ WYP1);
+}
+
+// Random seed from the kernel (falls back to time and pid)
+static uint64_t random_seed(void) {
+    uint64_t seed;
+    if (getrandom(&seed, sizeof(seed), 0) == sizeof(seed)) return seed;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return wy_mix((uint64_t)ts.tv_nsec ^ WYP2, (uint64_t)ts.tv_sec ^ ((uint64_t)getpid() << 32));
+}
+
+// Same key? The stored hash and length reject almost every mismatch
+// before the bytes are compared.
+static inline int node_matches(const HNode *node, const char *key, size_t klen, uint64_t h) {
+    return node->hcode == h && node->klen == klen && memcmp(node->data, key, klen) == 0;
+}
+
+// --- Single Table (HTab) ---
+// Two engines implement the same small set of table operations:
+//   h_init / h_free       allocate and release an empty table
+//   h_insert              add a node known not to be present
+//   h_lookup              find a key, returning the slot that points at it
+//   h_detach              remove the node behind a slot from h_lookup
+//   h_full                time to grow?
+//   h_pop                 detach one node from bucket `pos` (NULL once empty)
+//   h_bucket              first node of bucket `pos`, following ->next (sampling)
+//   h_bytes               memory held by the table itself
+//   h_assign              copy a table header (dst = src)
+//   h_prefetch            start loading the slots a key would be probed in
+//   h_prefetch_node       start loading the node h_lookup would compare first
+//   h_scan / h_scan_mask  SCAN buckets: every key in bucket `i` (i <= mask);
+//                         a key's bucket is its hash masked with h_scan_mask
+// The HMap layer below (incremental rehashing, API) is shared.
+
+#ifndef HMAP_SWISS
+
+// Chained engine: an array of singly linked lists.
+// Lock-free readers (hmap_lookup_lockfree) walk the same arrays and
+// chains, so the table pointer, the mask and every link are written with
+// atomic stores: a node is fully built before it becomes reachable.
+
+static inline void link_set(HNode **link, HNode *node) {
+    __atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
+static inline HNode *link_get(HNode **link) {
+    return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
+
+static void h_assign(HTab *dst, const HTab *src) {
+    __atomic_store_n(&dst->tab, src->tab, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->mask, src->mask, __ATOMIC_RELAXED);
+    dst->size = src->size;
+    dst->used = src->used;
+}
+
+// n must be a power of 2
+static void h_init(HTab *htab, size_t n) {
+    HTab fresh = {mem_calloc(n, sizeof(HNode *), MEM_TABLES), n - 1, n, 0};
+    h_assign(htab, &fresh);
+}
+
+static void h_free(HTab *htab) {
+    mem_free(htab->tab, htab->size * sizeof(HNode *), MEM_TABLES);
+    h_assign(htab, &(HTab){0});
+}
+
+// Insert at head of the chain (Tech tip: & mask is much faster than % size)
+static void h_insert(HTab *htab, HNode *node) {
+    size_t pos = node->hcode & htab->mask;
+    link_set(&node->next, htab->tab[pos]);
+    link_set(&htab->tab[pos], node);
+    htab->used++;
+}
+
+// Returns the address of the pointer that points at the matching node
+// (Pointer to Pointer: lets callers unlink or replace it), or NULL.
+static HNode **h_lookup(HTab *htab, const char *key, size_t klen, uint64_t h) {
+    if (!htab->tab) return NULL;
+
+    HNode **from = &htab->tab[h & htab->mask];
+    for (HNode *node; (node = *from) != NULL; from = &node->next) {
+        if (node_matches(node, key, klen, h)) {
+            return from;
+        }
+    }
+    return NULL;
+}
+
+// Cut a node out of its chain. Its own link is left alone: a reader
+// standing on it can still walk on.
+static HNode *h_detach(HTab *htab, HNode **from) {
+    HNode *node = *from;
+    link_set(from, node->next);
+    htab->used--;
+    return node;
+}
+
+// Load factor 1
+static int h_full(const HTab *htab) {
+    return htab->used >= htab->size;
+}
+
+static HNode *h_pop(HTab *htab, size_t pos) {
+    HNode **from = &htab->tab[pos];
+    return *from ? h_detach(htab, from) : NULL;
+}
+
+static HNode *h_bucket(const HTab *htab, size_t pos) {
+    return htab->tab[pos];
+}
+
+static size_t h_bytes(const HTab *htab) {
+    return htab->size * sizeof(HNode *);
+}
+
+static void h_prefetch(const HTab *htab, uint64_t h) {
+    if (htab->tab) __builtin_prefetch(&htab->tab[h & htab->mask]);
+}
+
+static void h_prefetch_node(const HTab *htab, uint64_t h) {
+    if (!htab->tab) return;
+    HNode *node = htab->tab[h & htab->mask];
+    if (node) __builtin_prefetch(node);
+}
+
+static size_t h_scan_mask(const HTab *htab) {
+    return htab->mask;
+}
+
+static void h_scan(const HTab *htab, size_t i, hmap_scan_fn fn, void *arg) {
+    for (HNode *node = htab->tab[i]; node; node = node->next) fn(node, arg);
+}
+
+// Reader side of h_lookup, on a snapshot of tab and mask
+static HNode *h_lookup_lockfree(HNode **tab, size_t mask, const char *key, size_t klen, uint64_t h) {
+    for (HNode *node = link_get(&tab[h & mask]); node; node = link_get(&node->next)) {
+        if (node_matches(node, key, klen, h)) return node;
+    }
+    return NULL;
+}
+
+#else // HMAP_SWISS
+
+// Swiss-table engine: open addressing over an array of node pointers with
+// one control byte per slot. A control byte is EMPTY, DELETED, or the low
+// 7 bits of the key's hash (the "tag"). Probing compares a whole 16-slot
+// group of control bytes against the tag at once, so most lookups touch
+// one cache line of control bytes and exactly one node.
+
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+#define GROUP_WIDTH  16
+#define K_SWISS_MIN_SIZE 16
+
+#define H1(h) ((h) >> 7)
+#define H2(h) ((uint8_t)((h) & 0x7F))
+
+// Bit i set if ctrl[i] == b, for the 16 bytes of a group
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t b) {
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) m |= (uint32_t)(ctrl[i] == b) << i;
+    return m;
+#endif
+}
+
+// Bit i set if slot i is EMPTY or DELETED (both have the high bit set)
+static inline uint32_t group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) m |= (uint32_t)(ctrl[i] >> 7) << i;
+    return m;
+#endif
+}
+
+// Groups are probed quadratically (triangular steps), which visits every
+// group once when the number of groups is a power of 2.
+#define PROBE_START(htab, h) ((H1(h) & (htab)->mask) & ~(size_t)(GROUP_WIDTH - 1))
+#define PROBE_NEXT(htab, pos, step) (((pos) + (step) * GROUP_WIDTH) & (htab)->mask)
+
+// n must be a power of 2, at least one group
+static void h_init(HTab *htab, size_t n) {
+    if (n < K_SWISS_MIN_SIZE) n = K_SWISS_MIN_SIZE;
+    htab->ctrl = mem_malloc(n, MEM_TABLES);
+    memset(htab->ctrl, CTRL_EMPTY, n);
+    htab->slots = mem_calloc(n, sizeof(HNode *), MEM_TABLES);
+    htab->mask = n - 1;
+    htab->size = n;
+    htab->used = 0;
+    htab->tombstones = 0;
+}
+
+static void h_free(HTab *htab) {
+    mem_free(htab->ctrl, htab->size, MEM_TABLES);
+    mem_free(htab->slots, htab->size * sizeof(HNode *), MEM_TABLES);
+    *htab = (HTab){0};
+}
+
+static void h_insert(HTab *htab, HNode *node) {
+    size_t pos = PROBE_START(htab, node->hcode);
+    for (size_t step = 1;; step++) {
+        uint32_t m = group_match_free(htab->ctrl + pos);
+        if (m) {
+            size_t i = pos + __builtin_ctz(m);
+            if (htab->ctrl[i] == CTRL_DELETED) htab->tombstones--;
+            htab->ctrl[i] = H2(node->hcode);
+            htab->slots[i] = node;
+            htab->used++;
+            return;
+        }
+        pos = PROBE_NEXT(htab, pos, step);
+    }
+}
+
+static HNode **h_lookup(HTab *htab, const char *key, size_t klen, uint64_t h) {
+    if (!htab->slots) return NULL;
+
+    uint8_t tag = H2(h);
+    size_t pos = PROBE_START(htab, h);
+    for (size_t step = 1; step <= (htab->mask >> 4) + 1; step++) {
+        const uint8_t *ctrl = htab->ctrl + pos;
+        for (uint32_t m = group_match(ctrl, tag); m; m &= m - 1) {
+            size_t i = pos + __builtin_ctz(m);
+            if (node_matches(htab->slots[i], key, klen, h)) {
+                return &htab->slots[i];
+            }
+        }
+        // An EMPTY slot ends the probe: the key would have been placed there
+        if (group_match(ctrl, CTRL_EMPTY)) return NULL;
+        pos = PROBE_NEXT(htab, pos, step);
+    }
+    return NULL;
+}
+
+static HNode *h_detach(HTab *htab, HNode **from) {
+    size_t i = from - htab->slots;
+    size_t group = i & ~(size_t)(GROUP_WIDTH - 1);
+    HNode *node = *from;
+
+    // A group that still has an EMPTY slot was never full, so no probe
+    // ever continued past it and this slot can become EMPTY again.
+    // Otherwise leave a tombstone so later probes keep going.
+    if (group_match(htab->ctrl + group, CTRL_EMPTY)) {
+        htab->ctrl[i] = CTRL_EMPTY;
+    } else {
+        htab->ctrl[i] = CTRL_DELETED;
+        htab->tombstones++;
+    }
+    *from = NULL;
+    htab->used--;
+    return node;
+}
+
+// Load factor 7/8, counting tombstones (they lengthen probes too)
+static int h_full(const HTab *htab) {
+    return (htab->used + htab->tombstones) * 8 >= htab->size * 7;
+}
+
+static HNode *h_pop(HTab *htab, size_t pos) {
+    if (htab->ctrl[pos] & 0x80) return NULL; // EMPTY or DELETED
+    return h_detach(htab, &htab->slots[pos]);
+}
+
+// One node per slot (its ->next is always NULL here)
+static HNode *h_bucket(const HTab *htab, size_t pos) {
+    return (htab->ctrl[pos] & 0x80) ? NULL : htab->slots[pos];
+}
+
+static size_t h_bytes(const HTab *htab) {
+    return htab->size * (sizeof(HNode *) + 1);
+}
+
+// No lock-free readers on this engine
+static void h_assign(HTab *dst, const HTab *src) {
+    *dst = *src;
+}
+
+// The first group's control bytes, and its 16 slots (two cache lines)
+static void h_prefetch(const HTab *htab, uint64_t h) {
+    if (!htab->slots) return;
+    size_t pos = PROBE_START(htab, h);
+    __builtin_prefetch(htab->ctrl + pos);
+    __builtin_prefetch(htab->slots + pos);
+    __builtin_prefetch(htab->slots + pos + GROUP_WIDTH / 2);
+}
+
+static void h_prefetch_node(const HTab *htab, uint64_t h) {
+    if (!htab->slots) return;
+    size_t pos = PROBE_START(htab, h);
+    uint32_t m = group_match(htab->ctrl + pos, H2(h));
+    if (m) __builtin_prefetch(htab->slots[pos + __builtin_ctz(m)]);
+}
+
+// SCAN buckets are groups: bucket g holds the keys whose probe starts at
+// group g, which sit between there and the first group with an EMPTY slot
+static size_t h_scan_mask(const HTab *htab) {
+    return htab->mask / GROUP_WIDTH;
+}
+
+static void h_scan(const HTab *htab, size_t g, hmap_scan_fn fn, void *arg) {
+    size_t home = g * GROUP_WIDTH;
+    size_t pos = home;
+    for (size_t step = 1; step <= (htab->mask >> 4) + 1; step++) {
+        const uint8_t *ctrl = htab->ctrl + pos;
+        for (size_t i = 0; i < GROUP_WIDTH; i++) {
+            HNode *node = htab->slots[pos + i];
+            if (!(ctrl[i] & 0x80) && PROBE_START(htab, node->hcode) == home) fn(node, arg);
+        }
+        if (group_match(ctrl, CTRL_EMPTY)) return;
+        pos = PROBE_NEXT(htab, pos, step);
+    }
+}
+
+#endif // HMAP_SWISS
+
+// --- Incremental Rehashing ---
+// Resizing in one go would move every node inside a single SET and stall
+// the server for as long as that takes on a big table. Instead each
+// operation moves a few buckets, and the event loop moves more when idle.
+
+#define K_REHASH_BUCKETS 16 // Buckets moved per hash map operation
+
+// Moving nodes between chains, or swapping tables, can make a lock-free
+// reader miss a key that is there: such changes happen inside a seqcount
+// write section, and a reader that sees the count change retries.
+static inline void seq_begin(HMap *hmap) {
+    __atomic_store_n(&hmap->seq, hmap->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_end(HMap *hmap) {
+    __atomic_store_n(&hmap->seq, hmap->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void hmap_retire(HMap *hmap, void *ptr, size_t bytes);
+
+// Release a drained table (later, if readers may still be in it)
+static void hmap_drop_table(HMap *hmap, HTab *htab) {
+#ifndef HMAP_SWISS
+    if (hmap->lockfree_reads) {
+        hmap_retire(hmap, htab->tab, h_bytes(htab));
+        h_assign(htab, &(HTab){0});
+        return;
+    }
+#else
+    (void)hmap;
+#endif
+    h_free(htab);
+}
+
+// Move everything in one bucket over (we just "move Pointers", no malloc/free)
+static int h_migrate(HTab *from, size_t pos, HTab *to) {
+    int moved = 0;
+    for (HNode *node; (node = h_pop(from, pos)) != NULL; moved = 1) {
+        h_insert(to, node);
+    }
+    return moved;
+}
+
+static int rehash_buckets(HMap *hmap, size_t nbuckets) {
+    HTab *older = &hmap->older;
+
+    // Cap the empty buckets we look at so a sparse table stays cheap
+    size_t empty_visits = nbuckets * 10;
+    while (nbuckets > 0 && older->used > 0) {
+        if (!h_migrate(older, hmap->migrate_pos++, &hmap->newer)) {
+            if (--empty_visits == 0) return 1;
+            continue;
+        }
+        nbuckets--;
+    }
+
+    // Discard old table once it is empty
+    if (older->used == 0) {
+        hmap_drop_table(hmap, older);
+        hmap->migrate_pos = 0;
+        return 0;
+    }
+    return 1;
+}
+
+int hmap_rehash(HMap *hmap, size_t nbuckets) {
+    if (!hmap->older.size) return 0;
+    seq_begin(hmap);
+    int more = rehash_buckets(hmap, nbuckets);
+    seq_end(hmap);
+    return more;
+}
+
+int hmap_is_rehashing(HMap *hmap) {
+    return hmap->older.size != 0;
+}
+
+// The current table is full: start moving to a new one. It is twice the
+// size unless the table is mostly tombstones, which a same-size copy clears.
+static void hmap_trigger_rehashing(HMap *hmap) {
+    seq_begin(hmap);
+    if (hmap_is_rehashing(hmap)) {
+        rehash_buckets(hmap, SIZE_MAX); // Still draining: finish that first
+    }
+    h_assign(&hmap->older, &hmap->newer);
+    size_t n = hmap->older.size;
+    if (hmap->older.used * 2 >= n) n *= 2;
+    h_init(&hmap->newer, n);
+    hmap->migrate_pos = 0;
+    seq_end(hmap);
+}
+
+// Nodes are allocated through a slab per map, which counts their memory.
+// By default every node is malloc'd. Built with NODE_ALLOC=slab
+// (-DSTORE_SLAB_PAGES), small nodes are cut from size-class pages instead.
+// That makes allocation cheaper, but on overwrite-heavy loads with mixed
+// value sizes it holds more memory than glibc (see slab.h).
+#ifdef STORE_SLAB_PAGES
+#define K_SLAB_PAGED 1
+#else
+#define K_SLAB_PAGED 0
+#endif
+
+// Bytes of the block behind a node (what slab_free needs back)
+static inline size_t hnode_block_size(const HNode *node) {
+    return sizeof(HNode) + node->klen + 1 + node->vcap + 1;
+}
+
+// --- Access Tracking (for eviction) ---
+// HNode.lru holds 24 bits, read according to the eviction policy:
+//   LRU: the access clock (seconds, wraps after ~194 days)
+//   LFU: minutes of the last decay (16 bits) << 8 | access counter (8 bits)
+// The LFU counter grows logarithmically (harder the higher it is) and
+// drops by one per idle minute, so it tracks recent popularity.
+
+#define LRU_CLOCK_MAX ((1 << 24) - 1)
+#define LFU_INIT_VAL 5      // New keys start here so they aren't evicted at once
+#define LFU_LOG_FACTOR 10
+#define LFU_DECAY_MINUTES 1
+
+static struct {
+    size_t maxmemory;        // 0 = no limit
+    int policy;              // EVICT_*
+    int samples;             // Keys looked at per eviction
+    uint32_t lru_clock;      // Seconds, refreshed by store_tick() (atomic)
+    uint32_t lfu_minutes;    // Minutes (16 bits), refreshed by store_tick() (atomic)
+} g_evict = {0, EVICT_NOEVICTION, 5, 0, 0};
+
+static inline uint32_t lru_clock(void) {
+    return __atomic_load_n(&g_evict.lru_clock, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t lfu_minutes(void) {
+    return __atomic_load_n(&g_evict.lfu_minutes, __ATOMIC_RELAXED);
+}
+
+static uint64_t sample_rand(void);
+
+// Decayed LFU counter of a node
+static unsigned lfu_counter(const HNode *node) {
+    unsigned ldt = node->lru >> 8;
+    unsigned counter = node->lru & 255;
+    unsigned elapsed = (lfu_minutes() - ldt) & 0xFFFF;
+    unsigned periods = elapsed / LFU_DECAY_MINUTES;
+    return periods > counter ? 0 : counter - periods;
+}
+
+// Record an access
+static inline void hnode_touch(HNode *node) {
+    if (g_evict.policy == EVICT_ALLKEYS_LFU) {
+        unsigned counter = lfu_counter(node);
+        if (counter < 255) {
+            unsigned base = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+            // Increment with probability 1 / (base * factor + 1)
+            double r = (double)(sample_rand() >> 11) / (double)(1ull << 53);
+            if (r * (base * LFU_LOG_FACTOR + 1) < 1.0) counter++;
+        }
+        node->lru = (lfu_minutes() << 8) | counter;
+    } else if (g_evict.policy == EVICT_ALLKEYS_LRU) {
+        node->lru = lru_clock();
+    }
+    // Other policies never look at it, and leaving the node alone keeps
+    // it immutable for lock-free readers
+}
+
+// Allocate a node holding copies of key and value (refcount 1: the table).
+// Returns NULL if out of memory.
+static HNode *hnode_new(HMap *hmap, uint64_t hcode, const char *key, size_t klen,
+                        const char *value, size_t vlen, uint8_t encoding) {
+    // The block is rounded up to its size class; the tail goes to the value
+    size_t need = sizeof(HNode) + klen + 1 + vlen + 1;
+    size_t total = slab_block_size(&hmap->slab, need);
+
+    HNode *node = slab_alloc(&hmap->slab, total);
+    if (!node) return NULL;
+    node->next = NULL;
+    node->hcode = hcode;
+    node->refcount = 1;
+    node->klen = (uint32_t)klen;
+    node->vlen = (uint32_t)vlen;
+    node->vcap = (uint32_t)(total - sizeof(HNode) - klen - 1 - 1);
+    node->encoding = encoding;
+    node->vidx = 0;
+    hmap->payload_bytes += klen + vlen;
+    node->lru = (g_evict.policy == EVICT_ALLKEYS_LFU)
+                    ? (lfu_minutes() << 8) | LFU_INIT_VAL
+                    : lru_clock();
+    memcpy(node->data, key, klen);
+    node->data[klen] = '\0';
+    memcpy(hnode_value(node), value, vlen);
+    hnode_value(node)[vlen] = '\0';
+    return node;
+}
+
+// Replies on other threads may drop their pins at any time, so the
+// count is atomic; the node's memory is only touched under its map's lock.
+// Pinning a node nobody holds any more (a use after free) trips the assert.
+void hnode_retain(HNode *node) {
+    int prev = __atomic_fetch_add(&node->refcount, 1, __ATOMIC_RELAXED);
+    assert(prev > 0);
+    (void)prev;
+}
+
+static inline int hnode_shared(HNode *node) {
+    return __atomic_load_n(&node->refcount, __ATOMIC_ACQUIRE) > 1;
+}
+
+static void hnode_free(HMap *hmap, HNode *node) {
+    if (node->encoding == HNODE_ENC_ZSET) zset_free(hnode_zset(node));
+    hmap->payload_bytes -= node->klen + node->vlen;
+    slab_free(&hmap->slab, node, hnode_block_size(node));
+}
+
+// Drop a reference with the map already locked
+static void hnode_unref(HMap *hmap, HNode *node) {
+    if (__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+    hnode_free(hmap, node);
+}
+
+// --- Deferred Freeing (lock-free reads) ---
+// A node or table unlinked while lock-free readers may still be walking
+// it goes on the map's retired list with an epoch stamp, and is released
+// once no reader from that epoch is left (see epoch.h).
+
+#define K_RETIRE_BATCH 64 // Retirements between reclaim attempts (at least)
+
+// Release the retired entries stamped before `safe`
+static void retired_free(HMap *hmap, uint64_t safe) {
+    size_t kept = 0;
+    for (size_t i = 0; i < hmap->nretired; i++) {
+        HRetired r = hmap->retired[i];
+        if (r.epoch >= safe) {
+            hmap->retired[kept++] = r;
+        } else if (r.bytes == 0) {
+            hnode_unref(hmap, r.ptr); // The table's reference
+        } else {
+#ifdef SLAB_POISON
+            memset(r.ptr, SLAB_POISON_BYTE, r.bytes);
+#endif
+            mem_free(r.ptr, r.bytes, MEM_TABLES);
+        }
+    }
+    hmap->nretired = kept;
+    // Entries still held by a slow reader don't make every retire rescan
+    hmap->retire_next = kept * 2 > K_RETIRE_BATCH ? kept * 2 : K_RETIRE_BATCH;
+}
+
+void hmap_reclaim(HMap *hmap) {
+    if (hmap->nretired) retired_free(hmap, epoch_safe());
+}
+
+static void hmap_retire(HMap *hmap, void *ptr, size_t bytes) {
+    if (hmap->nretired == hmap->retired_cap) {
+        size_t cap = hmap->retired_cap ? hmap->retired_cap * 2 : K_RETIRE_BATCH;
+        hmap->retired = mem_realloc(hmap->retired, hmap->retired_cap * sizeof(HRetired),
+                                    cap * sizeof(HRetired), MEM_TABLES);
+        hmap->retired_cap = cap;
+    }
+    hmap->retired[hmap->nretired++] = (HRetired){ptr, bytes, epoch_retire()};
+    if (hmap->nretired >= hmap->retire_next) hmap_reclaim(hmap);
+}
+
+// The table lets go of a node it no longer links
+static void hnode_drop(HMap *hmap, HNode *node) {
+    if (hmap->lockfree_reads) {
+        hmap_retire(hmap, node, 0);
+    } else {
+        hnode_unref(hmap, node);
+    }
+}
+
+// vidx is read by lock-free readers (a key with a TTL sends them to the lock)
+static inline void hnode_set_vidx(HNode *node, uint32_t vidx) {
+    __atomic_store_n(&node->vidx, vidx, __ATOMIC_RELAXED);
+}
+
+// Find a key in either table; also reports which table it is in
+static HNode **hmap_find(HMap *hmap, const char *key, size_t klen, uint64_t h, HTab **htab) {
+    *htab = &hmap->newer;
+    HNode **from = h_lookup(*htab, key, klen, h);
+    if (!from) {
+        *htab = &hmap->older;
+        from = h_lookup(*htab, key, klen, h);
+    }
+    return from;
+}
+
+// --- Expiry ---
+
+#define K_EXPIRE_SAMPLES 20     // Keys sampled per round of the active cycle
+#define K_EXPIRE_REPEAT_PCT 25  // Go another round if more than this % had expired
+
+int64_t store_mstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline int64_t hnode_expire(const HMap *hmap, const HNode *node) {
+    return node->vidx ? hmap->expires[node->vidx - 1].when : HMAP_NO_TTL;
+}
+
+static void expire_set(HMap *hmap, HNode *node, int64_t when) {
+    if (node->vidx) {
+        hmap->expires[node->vidx - 1].when = when;
+        return;
+    }
+    if (hmap->nexpires == hmap->expires_cap) {
+        size_t cap = hmap->expires_cap ? hmap->expires_cap * 2 : 16;
+        hmap->expires = mem_realloc(hmap->expires, hmap->expires_cap * sizeof(HExpire),
+                                    cap * sizeof(HExpire), MEM_TABLES);
+        hmap->expires_cap = cap;
+    }
+    hmap->expires[hmap->nexpires] = (HExpire){node, when};
+    hnode_set_vidx(node, (uint32_t)++hmap->nexpires);
+}
+
+// Drop a node's TTL: the last entry moves into its place
+static void expire_remove(HMap *hmap, HNode *node) {
+    if (!node->vidx) return;
+    HExpire *last = &hmap->expires[--hmap->nexpires];
+    hmap->expires[node->vidx - 1] = *last;
+    hnode_set_vidx(last->node, node->vidx);
+    hnode_set_vidx(node, 0);
+}
+
+// Remove the node behind `from` from the map
+static void hmap_unlink(HMap *hmap, HTab *htab, HNode **from) {
+    HNode *node = h_detach(htab, from);
+    expire_remove(hmap, node);
+    hnode_drop(hmap, node); // Freed now, or once pending replies and readers are done
+}
+
+static int g_loading;                 // See store_set_loading
+static store_removed_fn g_removed_fn; // See store_set_removed_hook
+
+// Remove a key the store drops by itself (expired or evicted), reporting
+// it first
+static void hmap_unlink_auto(HMap *hmap, HTab *htab, HNode **from) {
+    if (g_removed_fn) g_removed_fn(hnode_key_slice(*from));
+    hmap_unlink(hmap, htab, from);
+}
+
+// hmap_find, except that a key past its TTL is deleted and not returned
+// (unless loading). Counts as an access.
+static HNode **hmap_find_live(HMap *hmap, const char *key, size_t klen, uint64_t h, HTab **htab) {
+    HNode **from = hmap_find(hmap, key, klen, h, htab);
+    if (!from) return NULL;
+    if ((*from)->vidx && !g_loading && hnode_expire(hmap, *from) <= store_mstime()) {
+        hmap_unlink_auto(hmap, *htab, from);
+        hmap->expired_keys++;
+        return NULL;
+    }
+    hnode_touch(*from);
+    return from;
+}
+
+// xorshift64*: cheap randomness for sampling (one state per thread)
+static uint64_t sample_rand(void) {
+    static __thread uint64_t state;
+    if (!state) state = g_hash_seed | 1;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dull;
+}
+
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+size_t hmap_expire_cycle(HMap *hmap, long long budget_us) {
+    long long start = monotonic_us();
+    size_t removed = 0;
+
+    while (hmap->nexpires > 0) {
+        int64_t now = store_mstime();
+        size_t expired = 0;
+        size_t samples = hmap->nexpires < K_EXPIRE_SAMPLES ? hmap->nexpires : K_EXPIRE_SAMPLES;
+
+        for (size_t i = 0; i < samples && hmap->nexpires > 0; i++) {
+            HExpire *e = &hmap->expires[sample_rand() % hmap->nexpires];
+            if (e->when > now) continue;
+
+            HNode *node = e->node;
+            HTab *htab;
+            HNode **from = hmap_find(hmap, hnode_key(node), node->klen, node->hcode, &htab);
+            assert(from && *from == node);
+            hmap_unlink_auto(hmap, htab, from);
+            expired++;
+        }
+        removed += expired;
+
+        // Mostly live keys left: not worth more time until the next tick
+        if (expired * 100 <= samples * K_EXPIRE_REPEAT_PCT) break;
+        if (monotonic_us() - start >= budget_us) break;
+    }
+    hmap->expired_keys += removed;
+    return removed;
 }
 
 // --- API Implementation ---
 
+// Empty tables and TTL index (the slab is kept)
+static void hmap_reset(HMap *hmap) {
+    hmap->newer = (HTab){0};
+    hmap->older = (HTab){0};
+    hmap->migrate_pos = 0;
+    hmap->expires = NULL;
+    hmap->nexpires = 0;
+    hmap->expires_cap = 0;
+    hmap->expired_keys = 0;
+    hmap->evicted_keys = 0;
+    hmap->retired = NULL;
+    hmap->nretired = 0;
+    hmap->retired_cap = 0;
+    hmap->retire_next = K_RETIRE_BATCH;
+}
+
+// Maps are created before any thread starts
 void hmap_init(HMap *hmap) {
-    hmap->tab = NULL;
-    hmap->mask = 0;
-    hmap->size = 0;
-    hmap->used = 0;
+    if (!g_hash_seed) {
+        // First map: pick the seed every map shares
+        uint64_t seed = random_seed();
+        g_hash_seed = seed ^ wy_mix(seed ^ WYP0, WYP1); // Pre-mixed once, not per hash
+    }
+    hmap_reset(hmap);
+    slab_init(&hmap->slab, K_SLAB_PAGED);
+    hmap->payload_bytes = 0;
+    hmap->lockfree_reads = 0;
+    hmap->seq = 0;
+}
+
+int hmap_set_lockfree_reads(HMap *hmap) {
+#ifdef HMAP_SWISS
+    (void)hmap;
+    return 0;
+#else
+    hmap->lockfree_reads = 1;
+    return 1;
+#endif
+}
+
+#define K_LOCKFREE_TRIES 3 // Then let the caller take the lock
+
+static int lookup_lockfree(HMap *hmap, const char *key, size_t klen, uint64_t h, HNode **out) {
+#ifdef HMAP_SWISS
+    (void)hmap; (void)key; (void)klen; (void)h; (void)out;
+    return 0;
+#else
+    if (!hmap->lockfree_reads) return 0;
+
+    for (int tries = 0; tries < K_LOCKFREE_TRIES; tries++) {
+        uint64_t seq = __atomic_load_n(&hmap->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue; // Writer mid-move
+
+        HNode **tab = __atomic_load_n(&hmap->newer.tab, __ATOMIC_RELAXED);
+        size_t mask = __atomic_load_n(&hmap->newer.mask, __ATOMIC_RELAXED);
+        HNode **otab = __atomic_load_n(&hmap->older.tab, __ATOMIC_RELAXED);
+        size_t omask = __atomic_load_n(&hmap->older.mask, __ATOMIC_RELAXED);
+        // Tables swapped while we read them: tab and mask may not match
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hmap->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        HNode *node = tab ? h_lookup_lockfree(tab, mask, key, klen, h) : NULL;
+        if (!node && otab) node = h_lookup_lockfree(otab, omask, key, klen, h);
+
+        // Nodes moved between chains while we walked: a miss means nothing
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hmap->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        if (node && __atomic_load_n(&node->vidx, __ATOMIC_RELAXED)) return 0;
+        *out = node;
+        return 1;
+    }
+    return 0;
+#endif
+}
+
+int hmap_lookup_lockfree(HMap *hmap, Slice key, HNode **node) {
+    return lookup_lockfree(hmap, key.ptr, key.len, str_hash(key.ptr, key.len), node);
+}
+
+uint64_t hmap_hash(Slice key) {
+    return str_hash(key.ptr, key.len);
+}
+
+// Both tables while a resize is in progress
+void hmap_prefetch(HMap *hmap, uint64_t h) {
+    h_prefetch(&hmap->newer, h);
+    h_prefetch(&hmap->older, h);
+}
+
+void hmap_prefetch_node(HMap *hmap, uint64_t h) {
+    h_prefetch_node(&hmap->newer, h);
+    h_prefetch_node(&hmap->older, h);
 }
 
 // Lookup (GET)
-HNode *hmap_lookup(HMap *hmap, const char *key) {
-    if (!hmap->tab) return NULL;
+HNode *hmap_lookup(HMap *hmap, Slice key) {
+    return hmap_lookup_hashed(hmap, key, str_hash(key.ptr, key.len));
+}
+
+HNode *hmap_lookup_hashed(HMap *hmap, Slice key, uint64_t h) {
+    hmap_rehash(hmap, K_REHASH_BUCKETS);
+
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, h, &htab);
+    return from ? *from : NULL;
+}
+
+// Set key (hash h) to a value of the given encoding (shared by SET,
+// INCRBY and ZADD), given where the key was found: `from` is its slot
+// from hmap_find, or NULL for a key known to be missing, which is then
+// inserted. An existing TTL is dropped unless keep_ttl is set.
+// Returns HMAP_ERR_OOM, with the key left as it was, if no node could be
+// allocated.
+static int hmap_store_at(HMap *hmap, HNode **from, const char *key, size_t klen, uint64_t h,
+                         const char *value, size_t vlen, uint8_t encoding, int keep_ttl) {
+    if (from) {
+        HNode *node = *from;
+        // Overwrite in place when the new value fits and the old one isn't
+        // wasting a much bigger block. Not while a queued reply still
+        // points at the old value, or lock-free readers may be copying it:
+        // then swap in a fresh node and let the others drop the old one.
+        int in_place = !hmap->lockfree_reads && !hnode_shared(node) && vlen <= node->vcap &&
+                       node->vcap <= 2 * vlen + 64 &&
+                       node->encoding != HNODE_ENC_ZSET && encoding != HNODE_ENC_ZSET;
+        HNode *fresh = NULL;
+        if (!in_place) {
+            fresh = hnode_new(hmap, h, key, klen, value, vlen, encoding);
+            if (!fresh) return HMAP_ERR_OOM;
+        }
+        if (!keep_ttl) expire_remove(hmap, node);
+        if (in_place) {
+            memcpy(hnode_value(node), value, vlen);
+            hnode_value(node)[vlen] = '\0';
+            hmap->payload_bytes += vlen - node->vlen;
+            node->vlen = (uint32_t)vlen;
+            node->encoding = encoding;
+        } else {
+            fresh->next = node->next;
+            fresh->lru = node->lru;
+            __atomic_store_n(from, fresh, __ATOMIC_RELEASE); // Fully built before readers see it
+            if (node->vidx) {
+                // Hand the TTL over to the replacement
+                fresh->vidx = node->vidx;
+                hmap->expires[fresh->vidx - 1].node = fresh;
+                hnode_set_vidx(node, 0);
+            }
+            hnode_drop(hmap, node);
+        }
+    } else {
+        if (!hmap->newer.size) {
+            seq_begin(hmap);
+            h_init(&hmap->newer, K_INITIAL_SIZE);
+            seq_end(hmap);
+        }
+        HNode *node = hnode_new(hmap, h, key, klen, value, vlen, encoding);
+        if (!node) return HMAP_ERR_OOM;
+        h_insert(&hmap->newer, node);
 
-    uint64_t h = str_hash(key);
-    size_t pos = h & hmap->mask;
-    
-    HNode *node = hmap->tab[pos];
-    while (node) {
-        if (node->hcode == h && strcmp(node->key, key) == 0) {
-            return node;
+        // Check Load Factor: If full, start expanding
+        if (h_full(&hmap->newer)) {
+            hmap_trigger_rehashing(hmap);
         }
-        node = node->next;
     }
-    return NULL;
+    hmap_rehash(hmap, K_REHASH_BUCKETS);
+    return HMAP_OK;
+}
+
+// Look the key up in either table, then update or insert it
+static int hmap_store(HMap *hmap, const char *key, size_t klen, uint64_t h,
+                      const char *value, size_t vlen, uint8_t encoding, int keep_ttl) {
+    HTab *htab;
+    HNode **from = hmap_find(hmap, key, klen, h, &htab);
+    if (from) hnode_touch(*from);
+    return hmap_store_at(hmap, from, key, klen, h, value, vlen, encoding, keep_ttl);
 }
 
-// Insert (SET)
-void hmap_insert(HMap *hmap, const char *key, const char *value) {
-    // Check Load Factor: If full, expand
-    if (!hmap->tab || hmap->used >= hmap->size) {
-        hmap_resize(hmap);
+// Insert (SET). Canonical integers ("42", "-7") are stored int-encoded:
+// 8 bytes however many digits, and INCR needs no parsing.
+int hmap_insert(HMap *hmap, Slice key, Slice value) {
+    return hmap_insert_hashed(hmap, key, str_hash(key.ptr, key.len), value);
+}
+
+int hmap_insert_hashed(HMap *hmap, Slice key, uint64_t h, Slice value) {
+    int64_t ival;
+    if (slice_to_int64(value, &ival)) {
+        return hmap_store(hmap, key.ptr, key.len, h, (const char *)&ival, sizeof(ival), HNODE_ENC_INT, 0);
     }
+    return hmap_store(hmap, key.ptr, key.len, h, value.ptr, value.len, HNODE_ENC_RAW, 0);
+}
 
-    // 1. Try to find if Key exists (Update)
-    HNode *node = hmap_lookup(hmap, key);
+// Counter update (INCR/DECR/INCRBY/DECRBY)
+int hmap_incrby(HMap *hmap, Slice key, int64_t delta, int64_t *result) {
+    uint64_t h = str_hash(key.ptr, key.len);
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, h, &htab);
+
+    int64_t cur = 0;
+    HNode *node = from ? *from : NULL;
     if (node) {
-        free(node->value);
-        node->value = strdup(value);
-        return;
+        if (node->encoding == HNODE_ENC_ZSET) {
+            return HMAP_ERR_WRONGTYPE;
+        } else if (node->encoding == HNODE_ENC_INT) {
+            cur = hnode_int(node);
+        } else if (!slice_to_int64((Slice){hnode_value(node), node->vlen}, &cur)) {
+            return HMAP_ERR_NOT_INT;
+        }
     }
+    if (__builtin_add_overflow(cur, delta, &cur)) {
+        return HMAP_ERR_OVERFLOW;
+    }
+    *result = cur;
 
-    // 2. If not found, create new Node (Insert)
-    uint64_t h = str_hash(key);
-    node = malloc(sizeof(HNode));
-    node->next = NULL;
-    node->hcode = h;
-    node->key = strdup(key);
-    node->value = strdup(value);
+    // The common case: an int-encoded counter nobody else references
+    if (node && node->encoding == HNODE_ENC_INT && !hnode_shared(node) && !hmap->lockfree_reads) {
+        memcpy(hnode_value(node), &cur, sizeof(cur));
+        hmap_rehash(hmap, K_REHASH_BUCKETS);
+        return HMAP_OK;
+    }
+    // Reuse the slot found above rather than probing again
+    return hmap_store_at(hmap, from, key.ptr, key.len, h, (const char *)&cur, sizeof(cur),
+                         HNODE_ENC_INT, 1);
+}
 
-    // Insert into table
-    size_t pos = h & hmap->mask;
-    node->next = hmap->tab[pos];
-    hmap->tab[pos] = node;
-    hmap->used++;
+// ZADD and the other sorted set commands
+ZSet *hmap_zset(HMap *hmap, Slice key, int create, int *wrongtype) {
+    uint64_t h = str_hash(key.ptr, key.len);
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, h, &htab);
+    *wrongtype = 0;
+    if (from) {
+        HNode *node = *from;
+        if (node->encoding != HNODE_ENC_ZSET) {
+            *wrongtype = 1;
+            return NULL;
+        }
+        return hnode_zset(node);
+    }
+    if (!create) return NULL;
+
+    ZSet *zs = zset_new();
+    if (!zs) return NULL;
+    if (hmap_store_at(hmap, NULL, key.ptr, key.len, h, (const char *)&zs, sizeof(zs),
+                      HNODE_ENC_ZSET, 0) != HMAP_OK) {
+        zset_free(zs);
+        return NULL;
+    }
+    return zs;
 }
 
 // Delete (DEL) - return 1 if deleted, 0 if not found
-int hmap_delete(HMap *hmap, const char *key) {
-    if (!hmap->tab) return 0;
+int hmap_delete(HMap *hmap, Slice key) {
+    return hmap_delete_hashed(hmap, key, str_hash(key.ptr, key.len));
+}
 
-    uint64_t h = str_hash(key);
-    size_t pos = h & hmap->mask;
+int hmap_delete_hashed(HMap *hmap, Slice key, uint64_t h) {
+    hmap_rehash(hmap, K_REHASH_BUCKETS);
 
-    HNode **from = &hmap->tab[pos]; // Pointer to Pointer (Secret Technique)
-    
-    // Loop to find Node
-    while (*from) {
-        HNode *node = *from;
-        if (node->hcode == h && strcmp(node->key, key) == 0) {
-            // Found! Cut from Linked List
-            *from = node->next; // Point previous to next
-            
-            free(node->key);
-            free(node->value);
-            free(node);
-            hmap->used--;
-            return 1;
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, h, &htab);
+    if (!from) return 0;
+
+    // Found! Cut from Linked List
+    hmap_unlink(hmap, htab, from);
+    return 1;
+}
+
+// EXPIRE / PEXPIREAT
+int hmap_set_expire(HMap *hmap, Slice key, int64_t when) {
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, str_hash(key.ptr, key.len), &htab);
+    if (!from) return 0;
+
+    if (when <= store_mstime() && !g_loading) {
+        hmap_unlink_auto(hmap, htab, from); // Already in the past
+        hmap->expired_keys++;
+    } else {
+        expire_set(hmap, *from, when);
+    }
+    return 1;
+}
+
+// PERSIST
+int hmap_persist(HMap *hmap, Slice key) {
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, str_hash(key.ptr, key.len), &htab);
+    if (!from || !(*from)->vidx) return 0;
+    expire_remove(hmap, *from);
+    return 1;
+}
+
+// MEMORY USAGE: the node's block, its share of the table and its TTL entry
+int64_t hmap_memory_usage(HMap *hmap, Slice key) {
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, str_hash(key.ptr, key.len), &htab);
+    if (!from) return -1;
+
+    HNode *node = *from;
+    size_t bytes = hnode_block_size(node) + h_bytes(htab) / htab->size;
+    if (node->vidx) bytes += sizeof(HExpire);
+    if (node->encoding == HNODE_ENC_ZSET) bytes += zset_bytes(hnode_zset(node));
+    return (int64_t)bytes;
+}
+
+// TTL / PTTL
+int64_t hmap_get_expire(HMap *hmap, Slice key) {
+    HTab *htab;
+    HNode **from = hmap_find_live(hmap, key.ptr, key.len, str_hash(key.ptr, key.len), &htab);
+    if (!from) return HMAP_NO_KEY;
+    return hnode_expire(hmap, *from);
+}
+
+size_t hmap_size(HMap *hmap) {
+    return hmap->newer.used + hmap->older.used;
+}
+
+static void h_destroy(HMap *hmap, HTab *htab) {
+    for (size_t i = 0; i < htab->size && htab->used > 0; ++i) {
+        for (HNode *node; (node = h_pop(htab, i)) != NULL; ) {
+            hnode_unref(hmap, node);
         }
-        from = &node->next;
     }
-    return 0;
+    h_free(htab);
 }
 
+// The slab stays with the map (keeping at most one empty page per class)
 void hmap_destroy(HMap *hmap) {
-    for (size_t i = 0; i < hmap->size; ++i) {
-        HNode *node = hmap->tab[i];
-        while (node) {
-            HNode *next = node->next;
-            free(node->key);
-            free(node->value);
-            free(node);
-            node = next;
+    retired_free(hmap, UINT64_MAX); // No readers left by now
+    mem_free(hmap->retired, hmap->retired_cap * sizeof(HRetired), MEM_TABLES);
+    h_destroy(hmap, &hmap->newer);
+    h_destroy(hmap, &hmap->older);
+    mem_free(hmap->expires, hmap->expires_cap * sizeof(HExpire), MEM_TABLES);
+    hmap_reset(hmap);
+}
+
+// Sampling: walk buckets from a random position (in either table while
+// rehashing) and collect the nodes found along the way
+size_t hmap_sample(HMap *hmap, HNode **out, size_t n) {
+    size_t got = 0;
+    for (int tries = 0; got == 0 && tries < 8 && hmap_size(hmap) > 0; tries++) {
+        HTab *htab = &hmap->newer;
+        if (hmap->older.used > 0 && (hmap->newer.used == 0 || (sample_rand() & 1))) {
+            htab = &hmap->older;
+        }
+        size_t pos = sample_rand() & htab->mask;
+        for (size_t visits = 0; got < n && visits < n * 10 && visits <= htab->mask; visits++) {
+            for (HNode *node = h_bucket(htab, pos); node && got < n; node = node->next) {
+                out[got++] = node;
+            }
+            pos = (pos + 1) & htab->mask;
+        }
+    }
+    return got;
+}
+
+// --- SCAN ---
+
+static inline uint64_t rev64(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return __builtin_bswap64(v);
+}
+
+typedef struct ScanCtx {
+    HMap *hmap;
+    hmap_scan_fn fn;
+    void *arg;
+    int64_t now;
+    size_t found;
+} ScanCtx;
+
+// Keys past their TTL are skipped (lazy expiry deletes them later)
+static void scan_visit(HNode *node, void *arg) {
+    ScanCtx *ctx = arg;
+    if (node->vidx && hnode_expire(ctx->hmap, node) <= ctx->now) return;
+    ctx->found++;
+    ctx->fn(node, ctx->arg);
+}
+
+// Reverse-binary iteration (as in Redis' dictScan): the cursor is a bucket
+// index counted up from its high bits. A table that doubles splits bucket
+// i into i and i + size, which come right after each other in this
+// order, so buckets visited before a resize stay visited. While rehashing,
+// a bucket of the smaller table is visited together with every bucket of
+// the larger one it expands to.
+uint64_t hmap_scan(HMap *hmap, uint64_t cursor, hmap_scan_fn fn, void *arg, size_t *found) {
+    if (!hmap->newer.size) return 0;
+    ScanCtx ctx = {hmap, fn, arg, store_mstime(), 0};
+
+    HTab *small = &hmap->newer, *large = NULL;
+    if (hmap->older.size) {
+        small = &hmap->older;
+        large = &hmap->newer;
+        if (h_scan_mask(small) > h_scan_mask(large)) {
+            small = &hmap->newer;
+            large = &hmap->older;
         }
     }
-    free(hmap->tab);
-    hmap_init(hmap); // Reset struct
+
+    uint64_t v = cursor;
+    uint64_t m0 = h_scan_mask(small);
+    h_scan(small, v & m0, scan_visit, &ctx);
+    if (large) {
+        uint64_t m1 = h_scan_mask(large);
+        do {
+            h_scan(large, v & m1, scan_visit, &ctx);
+            v = (((v | m0) + 1) & ~m0) | (v & m0); // Next expansion of the same bucket
+        } while (v & (m0 ^ m1));
+    }
+
+    // Add one to the reversed index (0 once every bucket was visited)
+    v |= ~m0;
+    v = rev64(rev64(v) + 1);
+    *found += ctx.found;
+    return v;
 }
 
-// Global Store
-static HMap g_db;
+// --- Eviction ---
+// Approximated LRU/LFU as in Redis: rather than keeping every key in
+// access order, sample a few keys per eviction and keep the best
+// candidates seen so far in a small pool, so that each eviction picks
+// from many more keys than one sample holds. Pool entries pin their
+// node; one that was deleted or replaced meanwhile is simply skipped.
+// Each shard keeps its own pool and evictions go round the shards; keys
+// are spread evenly by hash, so the best key of one shard is close to
+// the best of all.
+
+#define K_EVPOOL_SIZE 16
+#define K_MAX_SAMPLES 64
+
+typedef struct EvictCand {
+    uint64_t score; // Higher = better to evict
+    HNode *node;
+} EvictCand;
+
+// One slice of the keyspace. Aligned so neighbouring locks don't share
+// a cache line.
+typedef struct Shard {
+    pthread_mutex_t lock;
+    HMap map;
+    EvictCand evpool[K_EVPOOL_SIZE]; // Sorted by score, best last
+    int evpool_len;
+} __attribute__((aligned(64))) Shard;
+
+static Shard g_shards[STORE_SHARDS];
+
+// The top bits pick the shard; the tables index with the low bits
+static inline Shard *shard_of_hash(uint64_t h) {
+    return &g_shards[h >> (64 - STORE_SHARD_BITS)];
+}
+
+static inline Shard *shard_of_map(HMap *map) {
+    return (Shard *)((char *)map - offsetof(Shard, map));
+}
+
+HMap *store_lock(Slice key) {
+    Shard *sh = shard_of_hash(str_hash(key.ptr, key.len));
+    pthread_mutex_lock(&sh->lock);
+    return &sh->map;
+}
+
+void store_unlock(HMap *map) {
+    pthread_mutex_unlock(&shard_of_map(map)->lock);
+}
+
+HMap *store_map(uint64_t h) {
+    return &shard_of_hash(h)->map;
+}
+
+_Static_assert(STORE_SHARDS <= 32, "shard sets are 32-bit masks");
+
+uint32_t store_lock_many(const uint64_t *hashes, size_t n) {
+    uint32_t shards = 0;
+    for (size_t i = 0; i < n; i++) {
+        shards |= 1u << (hashes[i] >> (64 - STORE_SHARD_BITS));
+    }
+    // Always in index order, so two multi-key commands can't deadlock
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        if (shards & (1u << i)) pthread_mutex_lock(&g_shards[i].lock);
+    }
+    return shards;
+}
+
+void store_unlock_many(uint32_t shards) {
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        if (shards & (1u << i)) pthread_mutex_unlock(&g_shards[i].lock);
+    }
+}
+
+// The last pin of a node that already left its table: free it in its shard
+void hnode_release(HNode *node) {
+    if (__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+    Shard *sh = shard_of_hash(node->hcode);
+    pthread_mutex_lock(&sh->lock);
+    hnode_free(&sh->map, node);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+void store_set_maxmemory(size_t maxmemory, int policy, int samples) {
+    g_evict.maxmemory = maxmemory;
+    g_evict.policy = policy;
+    if (samples < 1) samples = 1;
+    g_evict.samples = samples > K_MAX_SAMPLES ? K_MAX_SAMPLES : samples;
+}
+
+void store_tick(void) {
+    store_set_clock(store_mstime());
+}
+
+void store_set_clock(int64_t ms) {
+    __atomic_store_n(&g_evict.lru_clock, (uint32_t)(ms / 1000) & LRU_CLOCK_MAX, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_evict.lfu_minutes, (uint32_t)(ms / 60000) & 0xFFFF, __ATOMIC_RELAXED);
+}
+
+void store_set_loading(int loading) {
+    g_loading = loading;
+}
+
+void store_set_removed_hook(store_removed_fn fn) {
+    g_removed_fn = fn;
+}
+
+// Read without the shard locks: a slightly stale total is fine for
+// deciding whether to evict
+size_t store_used_memory(void) {
+    size_t used = mem_used(MEM_TABLES) + mem_used(MEM_ZSETS);
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        const Slab *slab = &g_shards[i].map.slab;
+        used += __atomic_load_n(&slab->used_bytes, __ATOMIC_RELAXED) +
+                __atomic_load_n(&slab->large_bytes, __ATOMIC_RELAXED);
+    }
+    return used;
+}
+
+static uint64_t evict_score(const HNode *node) {
+    if (g_evict.policy == EVICT_ALLKEYS_LFU) {
+        return 255 - lfu_counter(node);
+    }
+    // Idle time in clock ticks, allowing for one wrap of the clock
+    uint32_t now = lru_clock();
+    return now >= node->lru ? now - node->lru : now + (LRU_CLOCK_MAX - node->lru);
+}
+
+static void evpool_insert(Shard *sh, HNode *node, uint64_t score) {
+    EvictCand *pool = sh->evpool;
+    if (sh->evpool_len == K_EVPOOL_SIZE && score <= pool[0].score) return;
+    for (int i = 0; i < sh->evpool_len; i++) {
+        if (pool[i].node == node) return; // Already a candidate
+    }
+
+    int pos = 0;
+    if (sh->evpool_len == K_EVPOOL_SIZE) {
+        // Full: drop the weakest candidate to make room
+        hnode_unref(&sh->map, pool[0].node);
+        memmove(pool, pool + 1, --sh->evpool_len * sizeof(EvictCand));
+    }
+    while (pos < sh->evpool_len && pool[pos].score < score) pos++;
+    memmove(pool + pos + 1, pool + pos, (sh->evpool_len - pos) * sizeof(EvictCand));
+    hnode_retain(node);
+    pool[pos] = (EvictCand){score, node};
+    sh->evpool_len++;
+}
+
+// Evict one key from a locked shard. Returns 0 if there was nothing to evict.
+static int evict_one(Shard *sh) {
+    HMap *hmap = &sh->map;
+    if (g_evict.policy == EVICT_VOLATILE_TTL) {
+        for (int i = 0; i < g_evict.samples && hmap->nexpires > 0; i++) {
+            HExpire *e = &hmap->expires[sample_rand() % hmap->nexpires];
+            evpool_insert(sh, e->node, UINT64_MAX - (uint64_t)e->when);
+        }
+    } else {
+        HNode *sample[K_MAX_SAMPLES];
+        size_t n = hmap_sample(hmap, sample, g_evict.samples);
+        for (size_t i = 0; i < n; i++) {
+            evpool_insert(sh, sample[i], evict_score(sample[i]));
+        }
+    }
+
+    while (sh->evpool_len > 0) {
+        HNode *node = sh->evpool[--sh->evpool_len].node;
+        HTab *htab;
+        HNode **from = hmap_find(hmap, hnode_key(node), node->klen, node->hcode, &htab);
+        int live = from && *from == node;
+        if (live && g_evict.policy == EVICT_VOLATILE_TTL && !node->vidx) {
+            live = 0; // TTL was removed since it was sampled
+        }
+        hnode_unref(hmap, node); // The pool's reference
+        if (live) {
+            hmap_unlink_auto(hmap, htab, from);
+            hmap->evicted_keys++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int store_evict(void) {
+    static __thread unsigned next; // Shard to evict from next
+    if (g_evict.maxmemory == 0) return 0;
+
+    int misses = 0; // Shards in a row with nothing to evict
+    while (store_used_memory() > g_evict.maxmemory) {
+        if (g_evict.policy == EVICT_NOEVICTION) return -1;
+
+        Shard *sh = &g_shards[next++ % STORE_SHARDS];
+        pthread_mutex_lock(&sh->lock);
+        int evicted = evict_one(sh);
+        pthread_mutex_unlock(&sh->lock);
+
+        if (evicted) {
+            misses = 0;
+        } else if (++misses == STORE_SHARDS) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
 void store_init(void) {
-    hmap_init(&g_db);
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        pthread_mutex_init(&g_shards[i].lock, NULL);
+        hmap_init(&g_shards[i].map);
+        g_shards[i].evpool_len = 0;
+    }
+    store_tick();
+}
+
+int store_enable_lockfree_reads(void) {
+    if (g_evict.policy == EVICT_ALLKEYS_LRU || g_evict.policy == EVICT_ALLKEYS_LFU) return 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        if (!hmap_set_lockfree_reads(&g_shards[i].map)) return 0;
+    }
+    return 1;
+}
+
+void store_thread_init(void) {
+    if (epoch_register() == -1) {
+        fprintf(stderr, "store: out of epoch slots, this thread reads under the lock\n");
+    }
 }
 
-HMap *store_get_db(void) {
-    return &g_db;
-}
\ No newline at end of file
+void store_read_begin(void) {
+    if (epoch_registered()) epoch_enter();
+}
+
+void store_read_end(void) {
+    if (epoch_registered()) epoch_exit();
+}
+
+int store_lookup_lockfree(Slice key, HNode **node) {
+    if (!epoch_registered()) return 0;
+    uint64_t h = str_hash(key.ptr, key.len);
+    return lookup_lockfree(&shard_of_hash(h)->map, key.ptr, key.len, h, node);
+}
+
+void store_reclaim(int part, int nparts) {
+    for (int i = part; i < STORE_SHARDS; i += nparts) {
+        Shard *sh = &g_shards[i];
+        pthread_mutex_lock(&sh->lock);
+        hmap_reclaim(&sh->map);
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+// The shard is in the low bits of the cursor, its table's cursor above
+uint64_t store_scan(uint64_t cursor, size_t count, hmap_scan_fn fn, void *arg) {
+    size_t shard = cursor & (STORE_SHARDS - 1);
+    uint64_t v = cursor >> STORE_SHARD_BITS;
+    size_t found = 0;
+    size_t steps = count * 10; // Bounds the work on sparse tables
+    Shard *sh = NULL;          // Locked while we stay in it
+
+    while (found < count && steps-- > 0) {
+        if (!sh) {
+            sh = &g_shards[shard];
+            pthread_mutex_lock(&sh->lock);
+        }
+        v = hmap_scan(&sh->map, v, fn, arg, &found);
+        if (v == 0) {
+            pthread_mutex_unlock(&sh->lock);
+            sh = NULL;
+            if (++shard == STORE_SHARDS) return 0; // Every shard done
+        }
+    }
+    if (sh) pthread_mutex_unlock(&sh->lock);
+    return (v << STORE_SHARD_BITS) | shard;
+}
+
+// Shards handled by caller `part` of `nparts`
+static int shards_of(int part, int nparts) {
+    return part < STORE_SHARDS ? (STORE_SHARDS - part + nparts - 1) / nparts : 0;
+}
+
+size_t store_expire_cycle(int part, int nparts, long long budget_us) {
+    int owned = shards_of(part, nparts);
+    size_t removed = 0;
+    for (int i = part; i < STORE_SHARDS; i += nparts) {
+        Shard *sh = &g_shards[i];
+        pthread_mutex_lock(&sh->lock);
+        removed += hmap_expire_cycle(&sh->map, budget_us / owned);
+        pthread_mutex_unlock(&sh->lock);
+    }
+    return removed;
+}
+
+// A few buckets per lock hold, so writers to the shard barely notice
+int store_rehash(int part, int nparts, long long budget_us) {
+    long long start = monotonic_us();
+    int pending = 0;
+    for (int i = part; i < STORE_SHARDS; i += nparts) {
+        Shard *sh = &g_shards[i];
+        int more = 1;
+        while (more && monotonic_us() - start < budget_us) {
+            pthread_mutex_lock(&sh->lock);
+            more = hmap_rehash(&sh->map, 100);
+            pthread_mutex_unlock(&sh->lock);
+        }
+        if (more) {
+            pthread_mutex_lock(&sh->lock);
+            more = hmap_is_rehashing(&sh->map);
+            pthread_mutex_unlock(&sh->lock);
+        }
+        pending |= more;
+    }
+    return pending;
+}
+
+size_t store_alloc_info(char *buf, size_t size) {
+    Slab total; // Statistics of every shard's slab added up
+    slab_init(&total, K_SLAB_PAGED);
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        pthread_mutex_lock(&g_shards[i].lock);
+        slab_merge_stats(&total, &g_shards[i].map.slab);
+        pthread_mutex_unlock(&g_shards[i].lock);
+    }
+    return slab_stats_info(&total, buf, size);
+}
+
+// Human-readable byte count ("1.50M")
+static void bytes_human(char *buf, size_t size, size_t n) {
+    const char *units = "BKMGT";
+    double v = (double)n;
+    int u = 0;
+    while (v >= 1024 && units[u + 1]) {
+        v /= 1024;
+        u++;
+    }
+    snprintf(buf, size, u ? "%.2f%c" : "%.0f%c", v, units[u]);
+}
+
+size_t store_memory_info(char *buf, size_t size) {
+    size_t used = mem_used_total();
+    size_t rss = mem_rss();
+    size_t nodes = 0, payload = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        HMap *map = &g_shards[i].map;
+        pthread_mutex_lock(&g_shards[i].lock);
+        nodes += map->slab.used_bytes + map->slab.large_bytes;
+        payload += map->payload_bytes;
+        pthread_mutex_unlock(&g_shards[i].lock);
+    }
+    size_t clients = mem_used(MEM_CLIENT_QUERY) + mem_used(MEM_CLIENT_REPLY) + mem_used(MEM_CLIENT_OTHER);
+    char used_h[16], peak_h[16];
+    bytes_human(used_h, sizeof(used_h), used);
+    bytes_human(peak_h, sizeof(peak_h), mem_peak());
+
+    size_t len = snprintf(buf, size,
+                          "# Memory\r\n"
+                          "used_memory:%zu\r\n"
+                          "used_memory_human:%s\r\n"
+                          "used_memory_peak:%zu\r\n"
+                          "used_memory_peak_human:%s\r\n"
+                          "used_memory_rss:%zu\r\n"
+                          "used_memory_keyspace:%zu\r\n"
+                          "used_memory_dataset:%zu\r\n"
+                          "used_memory_payload:%zu\r\n"
+                          "used_memory_node_overhead:%zu\r\n"
+                          "used_memory_tables:%zu\r\n"
+                          "used_memory_zsets:%zu\r\n"
+                          "used_memory_slab_free:%zu\r\n"
+                          "used_memory_clients:%zu\r\n"
+                          "mem_clients_query:%zu\r\n"
+                          "mem_clients_reply:%zu\r\n"
+                          "mem_fragmentation_ratio:%.2f\r\n"
+                          "maxmemory:%zu\r\n",
+                          used, used_h, mem_peak(), peak_h, rss,
+                          store_used_memory(),
+                          nodes, payload, nodes - payload,
+                          mem_used(MEM_TABLES), mem_used(MEM_ZSETS),
+                          mem_used(MEM_NODES) - nodes,
+                          clients, mem_used(MEM_CLIENT_QUERY), mem_used(MEM_CLIENT_REPLY),
+                          used ? (double)rss / used : 0.0,
+                          g_evict.maxmemory);
+    return len < size ? len : size - 1;
+}
+
+size_t store_keyspace_info(char *buf, size_t size) {
+    size_t keys = 0, expires = 0;
+    uint64_t expired = 0, evicted = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        HMap *map = &g_shards[i].map;
+        pthread_mutex_lock(&g_shards[i].lock);
+        keys += hmap_size(map);
+        expires += map->nexpires;
+        expired += map->expired_keys;
+        evicted += map->evicted_keys;
+        pthread_mutex_unlock(&g_shards[i].lock);
+    }
+
+    size_t len = snprintf(buf, size,
+                          "# Keyspace\r\n"
+                          "db0:keys=%zu,expires=%zu\r\n"
+                          "expired_keys:%llu\r\n"
+                          "evicted_keys:%llu\r\n",
+                          keys, expires,
+                          (unsigned long long)expired,
+                          (unsigned long long)evicted);
+    return len < size ? len : size - 1;
+}
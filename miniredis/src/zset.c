@@ -0,0 +1,554 @@
+#include <stdint.h>
+#include <string.h>
+#include "mem.h"
+#include "store.h" // hmap_hash
+#include "zset.h"
+
+#define K_ZSL_MAXLEVEL 32
+#define K_ZSL_P 0.25           // Chance a node reaches the next level
+#define K_ZSET_INIT_BUCKETS 256 // Member hash size when the skiplist is built
+
+enum { ZSET_ENC_COMPACT, ZSET_ENC_SKIPLIST };
+
+// Compact entry: [double score][uint32 length][member bytes], unaligned
+#define ZC_HEADER (sizeof(double) + sizeof(uint32_t))
+
+typedef struct ZNode {
+    double score;
+    struct ZNode *backward; // Previous node on level 0 (NULL for the first)
+    struct ZNode *hnext;    // Next node in the member hash bucket
+    uint64_t hcode;
+    uint32_t mlen;
+    uint32_t nlevels;
+    struct ZLevel {
+        struct ZNode *forward;
+        size_t span; // Level-0 steps to `forward` (ranks)
+    } level[];
+    // Member bytes follow level[nlevels]
+} ZNode;
+
+struct ZSet {
+    int encoding;
+    size_t card;
+    size_t bytes; // Everything below plus this struct
+    // Compact encoding
+    char *entries;
+    size_t used, cap;
+    // Skiplist encoding
+    ZNode *header, *tail;
+    int level;
+    ZNode **buckets;
+    size_t nbuckets; // Power of two
+};
+
+static inline char *znode_member(const ZNode *node) {
+    return (char *)&node->level[node->nlevels];
+}
+
+static inline size_t znode_size(uint32_t nlevels, size_t mlen) {
+    return sizeof(ZNode) + nlevels * sizeof(struct ZLevel) + mlen;
+}
+
+static int member_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+// (score, member) order
+static inline int entry_cmp(double sa, const char *a, size_t alen,
+                            double sb, const char *b, size_t blen) {
+    if (sa != sb) return sa < sb ? -1 : 1;
+    return member_cmp(a, alen, b, blen);
+}
+
+static void *zs_alloc(ZSet *zs, size_t size) {
+    void *ptr = mem_malloc(size, MEM_ZSETS);
+    if (ptr) zs->bytes += size;
+    return ptr;
+}
+
+static void zs_free(ZSet *zs, void *ptr, size_t size) {
+    if (!ptr) return;
+    zs->bytes -= size;
+    mem_free(ptr, size, MEM_ZSETS);
+}
+
+ZSet *zset_new(void) {
+    ZSet *zs = mem_calloc(1, sizeof(*zs), MEM_ZSETS);
+    if (!zs) return NULL;
+    zs->encoding = ZSET_ENC_COMPACT;
+    zs->bytes = sizeof(*zs);
+    return zs;
+}
+
+void zset_free(ZSet *zs) {
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        zs_free(zs, zs->entries, zs->cap);
+    } else {
+        ZNode *node = zs->header->level[0].forward;
+        while (node) {
+            ZNode *next = node->level[0].forward;
+            zs_free(zs, node, znode_size(node->nlevels, node->mlen));
+            node = next;
+        }
+        zs_free(zs, zs->header, znode_size(K_ZSL_MAXLEVEL, 0));
+        zs_free(zs, zs->buckets, zs->nbuckets * sizeof(ZNode *));
+    }
+    mem_free(zs, sizeof(*zs), MEM_ZSETS);
+}
+
+size_t zset_card(const ZSet *zs) {
+    return zs->card;
+}
+
+size_t zset_bytes(const ZSet *zs) {
+    return zs->bytes;
+}
+
+// ---- Compact encoding ----
+
+typedef struct {
+    double score;
+    const char *member;
+    uint32_t mlen;
+} ZEntry;
+
+static inline void zc_entry(const char *p, ZEntry *e) {
+    memcpy(&e->score, p, sizeof(double));
+    memcpy(&e->mlen, p + sizeof(double), sizeof(uint32_t));
+    e->member = p + ZC_HEADER;
+}
+
+// Offset of the member's entry, or -1
+static long zc_find(const ZSet *zs, Slice member, ZEntry *e) {
+    for (size_t off = 0; off < zs->used; off += ZC_HEADER + e->mlen) {
+        zc_entry(zs->entries + off, e);
+        if (e->mlen == member.len && memcmp(e->member, member.ptr, member.len) == 0) {
+            return (long)off;
+        }
+    }
+    return -1;
+}
+
+static void zc_delete(ZSet *zs, size_t off) {
+    ZEntry e;
+    zc_entry(zs->entries + off, &e);
+    size_t size = ZC_HEADER + e.mlen;
+    memmove(zs->entries + off, zs->entries + off + size, zs->used - off - size);
+    zs->used -= size;
+    zs->card--;
+}
+
+static int zc_insert(ZSet *zs, double score, Slice member) {
+    size_t size = ZC_HEADER + member.len;
+    if (zs->used + size > zs->cap) {
+        size_t cap = zs->cap ? zs->cap * 2 : 128;
+        while (cap < zs->used + size) cap *= 2;
+        char *entries = mem_realloc(zs->entries, zs->cap, cap, MEM_ZSETS);
+        if (!entries) return -1;
+        zs->bytes += cap - zs->cap;
+        zs->entries = entries;
+        zs->cap = cap;
+    }
+
+    size_t off = 0;
+    while (off < zs->used) {
+        ZEntry e;
+        zc_entry(zs->entries + off, &e);
+        if (entry_cmp(e.score, e.member, e.mlen, score, member.ptr, member.len) > 0) break;
+        off += ZC_HEADER + e.mlen;
+    }
+    char *p = zs->entries + off;
+    memmove(p + size, p, zs->used - off);
+    uint32_t mlen = (uint32_t)member.len;
+    memcpy(p, &score, sizeof(double));
+    memcpy(p + sizeof(double), &mlen, sizeof(uint32_t));
+    memcpy(p + ZC_HEADER, member.ptr, member.len);
+    zs->used += size;
+    zs->card++;
+    return 0;
+}
+
+// ---- Skiplist encoding ----
+
+// Levels are geometric with p = 1/4, as in Redis
+static int random_level(void) {
+    static __thread uint64_t state;
+    if (!state) state = (uintptr_t)&state ^ 0x9e3779b97f4a7c15ULL;
+    int level = 1;
+    for (;;) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if ((state & 0xFFFF) >= (uint64_t)(K_ZSL_P * 0xFFFF) || level == K_ZSL_MAXLEVEL) break;
+        level++;
+    }
+    return level;
+}
+
+static ZNode *znode_new(ZSet *zs, int nlevels, double score, Slice member, uint64_t hcode) {
+    ZNode *node = zs_alloc(zs, znode_size(nlevels, member.len));
+    if (!node) return NULL;
+    memset(node, 0, sizeof(ZNode) + nlevels * sizeof(struct ZLevel));
+    node->score = score;
+    node->hcode = hcode;
+    node->mlen = (uint32_t)member.len;
+    node->nlevels = nlevels;
+    memcpy(znode_member(node), member.ptr, member.len);
+    return node;
+}
+
+static inline int znode_before(const ZNode *node, double score, const char *member, size_t mlen) {
+    return entry_cmp(node->score, znode_member(node), node->mlen, score, member, mlen) < 0;
+}
+
+// Put a node (not in the list) at its place by score and member
+static void zsl_link(ZSet *zs, ZNode *x) {
+    ZNode *update[K_ZSL_MAXLEVEL];
+    size_t rank[K_ZSL_MAXLEVEL];
+    const char *member = znode_member(x);
+
+    ZNode *node = zs->header;
+    for (int i = zs->level - 1; i >= 0; i--) {
+        rank[i] = i == zs->level - 1 ? 0 : rank[i + 1];
+        while (node->level[i].forward &&
+               znode_before(node->level[i].forward, x->score, member, x->mlen)) {
+            rank[i] += node->level[i].span;
+            node = node->level[i].forward;
+        }
+        update[i] = node;
+    }
+    int level = x->nlevels;
+    if (level > zs->level) {
+        for (int i = zs->level; i < level; i++) {
+            rank[i] = 0;
+            update[i] = zs->header;
+            update[i]->level[i].span = zs->card;
+        }
+        zs->level = level;
+    }
+    for (int i = 0; i < level; i++) {
+        x->level[i].forward = update[i]->level[i].forward;
+        update[i]->level[i].forward = x;
+        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+        update[i]->level[i].span = rank[0] - rank[i] + 1;
+    }
+    for (int i = level; i < zs->level; i++) update[i]->level[i].span++;
+
+    x->backward = update[0] == zs->header ? NULL : update[0];
+    if (x->level[0].forward) {
+        x->level[0].forward->backward = x;
+    } else {
+        zs->tail = x;
+    }
+    zs->card++;
+}
+
+// Take a node out of the list (it stays in the member hash)
+static void zsl_unlink(ZSet *zs, ZNode *x) {
+    ZNode *update[K_ZSL_MAXLEVEL];
+    const char *member = znode_member(x);
+
+    ZNode *node = zs->header;
+    for (int i = zs->level - 1; i >= 0; i--) {
+        while (node->level[i].forward &&
+               znode_before(node->level[i].forward, x->score, member, x->mlen)) {
+            node = node->level[i].forward;
+        }
+        update[i] = node;
+    }
+    for (int i = 0; i < zs->level; i++) {
+        if (update[i]->level[i].forward == x) {
+            update[i]->level[i].span += x->level[i].span - 1;
+            update[i]->level[i].forward = x->level[i].forward;
+        } else {
+            update[i]->level[i].span--;
+        }
+    }
+    if (x->level[0].forward) {
+        x->level[0].forward->backward = x->backward;
+    } else {
+        zs->tail = x->backward;
+    }
+    while (zs->level > 1 && !zs->header->level[zs->level - 1].forward) zs->level--;
+    zs->card--;
+}
+
+// Node at 0-based rank (< card)
+static ZNode *zsl_at(const ZSet *zs, size_t rank) {
+    size_t traversed = 0;
+    rank++; // Spans count the header as rank 0
+    ZNode *node = zs->header;
+    for (int i = zs->level - 1; i >= 0; i--) {
+        while (node->level[i].forward && traversed + node->level[i].span <= rank) {
+            traversed += node->level[i].span;
+            node = node->level[i].forward;
+        }
+        if (traversed == rank) return node;
+    }
+    return NULL;
+}
+
+// How many members score below `score` (or equal to it, with `inclusive`)
+static size_t zsl_count_below(const ZSet *zs, double score, int inclusive) {
+    size_t traversed = 0;
+    ZNode *node = zs->header;
+    for (int i = zs->level - 1; i >= 0; i--) {
+        for (ZNode *next = node->level[i].forward;
+             next && (next->score < score || (inclusive && next->score == score));
+             next = node->level[i].forward) {
+            traversed += node->level[i].span;
+            node = next;
+        }
+    }
+    return traversed;
+}
+
+static ZNode *zh_find(const ZSet *zs, Slice member, uint64_t hcode) {
+    ZNode *node = zs->buckets[hcode & (zs->nbuckets - 1)];
+    for (; node; node = node->hnext) {
+        if (node->hcode == hcode && node->mlen == member.len &&
+            memcmp(znode_member(node), member.ptr, member.len) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// Double the member hash once it holds more nodes than buckets
+static void zh_insert(ZSet *zs, ZNode *x) {
+    if (zs->card >= zs->nbuckets) {
+        size_t n = zs->nbuckets * 2;
+        ZNode **buckets = zs_alloc(zs, n * sizeof(ZNode *));
+        if (buckets) { // Otherwise the chains just get longer
+            memset(buckets, 0, n * sizeof(ZNode *));
+            for (size_t i = 0; i < zs->nbuckets; i++) {
+                ZNode *node = zs->buckets[i];
+                while (node) {
+                    ZNode *next = node->hnext;
+                    node->hnext = buckets[node->hcode & (n - 1)];
+                    buckets[node->hcode & (n - 1)] = node;
+                    node = next;
+                }
+            }
+            zs_free(zs, zs->buckets, zs->nbuckets * sizeof(ZNode *));
+            zs->buckets = buckets;
+            zs->nbuckets = n;
+        }
+    }
+    ZNode **slot = &zs->buckets[x->hcode & (zs->nbuckets - 1)];
+    x->hnext = *slot;
+    *slot = x;
+}
+
+static void zh_delete(ZSet *zs, ZNode *x) {
+    ZNode **slot = &zs->buckets[x->hcode & (zs->nbuckets - 1)];
+    while (*slot != x) slot = &(*slot)->hnext;
+    *slot = x->hnext;
+}
+
+static int zsl_insert(ZSet *zs, double score, Slice member, uint64_t hcode) {
+    ZNode *node = znode_new(zs, random_level(), score, member, hcode);
+    if (!node) return -1;
+    zsl_link(zs, node);
+    zh_insert(zs, node);
+    return 0;
+}
+
+// One-way switch from the compact array. Every node is allocated before
+// anything changes, so running out of memory leaves the set as it was.
+static int zset_convert(ZSet *zs) {
+    size_t hsize = K_ZSET_INIT_BUCKETS * sizeof(ZNode *);
+    ZNode *header = zs_alloc(zs, znode_size(K_ZSL_MAXLEVEL, 0));
+    ZNode **buckets = zs_alloc(zs, hsize);
+    ZNode *nodes = NULL; // Chained through hnext, in reverse
+    int oom = !header || !buckets;
+
+    ZEntry e;
+    for (size_t off = 0; off < zs->used && !oom; off += ZC_HEADER + e.mlen) {
+        zc_entry(zs->entries + off, &e);
+        Slice member = {e.member, e.mlen};
+        ZNode *node = znode_new(zs, random_level(), e.score, member, hmap_hash(member));
+        if (!node) {
+            oom = 1;
+            break;
+        }
+        node->hnext = nodes;
+        nodes = node;
+    }
+    if (oom) {
+        while (nodes) {
+            ZNode *next = nodes->hnext;
+            zs_free(zs, nodes, znode_size(nodes->nlevels, nodes->mlen));
+            nodes = next;
+        }
+        zs_free(zs, header, znode_size(K_ZSL_MAXLEVEL, 0));
+        zs_free(zs, buckets, hsize);
+        return -1;
+    }
+
+    memset(header, 0, znode_size(K_ZSL_MAXLEVEL, 0));
+    header->nlevels = K_ZSL_MAXLEVEL;
+    memset(buckets, 0, hsize);
+    zs_free(zs, zs->entries, zs->cap);
+    zs->encoding = ZSET_ENC_SKIPLIST;
+    zs->header = header;
+    zs->tail = NULL;
+    zs->level = 1;
+    zs->buckets = buckets;
+    zs->nbuckets = K_ZSET_INIT_BUCKETS;
+    zs->card = 0;
+    zs->entries = NULL;
+    zs->used = zs->cap = 0;
+
+    while (nodes) {
+        ZNode *next = nodes->hnext;
+        zsl_link(zs, nodes);
+        zh_insert(zs, nodes);
+        nodes = next;
+    }
+    return 0;
+}
+
+// ---- Operations ----
+
+static int should_update(double old, double score, int flags) {
+    if (old == score) return 0;
+    if ((flags & ZADD_GT) && score <= old) return 0;
+    if ((flags & ZADD_LT) && score >= old) return 0;
+    return 1;
+}
+
+int zset_add(ZSet *zs, double score, Slice member, int flags) {
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        ZEntry e;
+        long off = zc_find(zs, member, &e);
+        if (off >= 0) {
+            if ((flags & ZADD_NX) || !should_update(e.score, score, flags)) return ZADD_NOP;
+            zc_delete(zs, off);
+            zc_insert(zs, score, member); // Fits: the entry just left
+            return ZADD_UPDATED;
+        }
+        if (flags & ZADD_XX) return ZADD_NOP;
+        if (zs->card < ZSET_COMPACT_MAX_ENTRIES && member.len <= ZSET_COMPACT_MAX_MEMBER) {
+            return zc_insert(zs, score, member) == -1 ? ZADD_OOM : ZADD_ADDED;
+        }
+        if (zset_convert(zs) == -1) return ZADD_OOM;
+    }
+
+    uint64_t hcode = hmap_hash(member);
+    ZNode *node = zh_find(zs, member, hcode);
+    if (node) {
+        if ((flags & ZADD_NX) || !should_update(node->score, score, flags)) return ZADD_NOP;
+        zsl_unlink(zs, node);
+        node->score = score;
+        zsl_link(zs, node);
+        return ZADD_UPDATED;
+    }
+    if (flags & ZADD_XX) return ZADD_NOP;
+    return zsl_insert(zs, score, member, hcode) == -1 ? ZADD_OOM : ZADD_ADDED;
+}
+
+int zset_remove(ZSet *zs, Slice member) {
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        ZEntry e;
+        long off = zc_find(zs, member, &e);
+        if (off < 0) return 0;
+        zc_delete(zs, off);
+        return 1;
+    }
+    ZNode *node = zh_find(zs, member, hmap_hash(member));
+    if (!node) return 0;
+    zh_delete(zs, node);
+    zsl_unlink(zs, node);
+    zs_free(zs, node, znode_size(node->nlevels, node->mlen));
+    return 1;
+}
+
+int zset_score(const ZSet *zs, Slice member, double *score) {
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        ZEntry e;
+        if (zc_find(zs, member, &e) < 0) return 0;
+        *score = e.score;
+        return 1;
+    }
+    ZNode *node = zh_find(zs, member, hmap_hash(member));
+    if (!node) return 0;
+    *score = node->score;
+    return 1;
+}
+
+long long zset_rank(const ZSet *zs, Slice member) {
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        ZEntry e;
+        long long rank = 0;
+        for (size_t off = 0; off < zs->used; off += ZC_HEADER + e.mlen, rank++) {
+            zc_entry(zs->entries + off, &e);
+            if (e.mlen == member.len && memcmp(e.member, member.ptr, member.len) == 0) {
+                return rank;
+            }
+        }
+        return -1;
+    }
+
+    const ZNode *x = zh_find(zs, member, hmap_hash(member));
+    if (!x) return -1;
+    // Walk down to the node, summing spans
+    size_t rank = 0;
+    const ZNode *node = zs->header;
+    for (int i = zs->level - 1; i >= 0; i--) {
+        while (node->level[i].forward && node->level[i].forward != x &&
+               znode_before(node->level[i].forward, x->score, member.ptr, member.len)) {
+            rank += node->level[i].span;
+            node = node->level[i].forward;
+        }
+        if (node->level[i].forward == x) return (long long)(rank + node->level[i].span - 1);
+    }
+    return -1;
+}
+
+void zset_range(const ZSet *zs, size_t start, size_t stop, int rev,
+                zset_range_fn fn, void *arg) {
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        size_t offs[ZSET_COMPACT_MAX_ENTRIES];
+        size_t n = 0;
+        ZEntry e;
+        for (size_t off = 0; off < zs->used; off += ZC_HEADER + e.mlen) {
+            zc_entry(zs->entries + off, &e);
+            offs[n++] = off;
+        }
+        for (size_t r = start; r <= stop; r++) {
+            zc_entry(zs->entries + offs[rev ? n - 1 - r : r], &e);
+            fn((Slice){e.member, e.mlen}, e.score, arg);
+        }
+        return;
+    }
+
+    // One O(log n) descent to the first node, then k steps along level 0
+    const ZNode *node = zsl_at(zs, rev ? zs->card - 1 - start : start);
+    for (size_t r = start; r <= stop && node; r++) {
+        fn((Slice){znode_member(node), node->mlen}, node->score, arg);
+        node = rev ? node->backward : node->level[0].forward;
+    }
+}
+
+int zset_score_ranks(const ZSet *zs, const ZScoreRange *range, size_t *first, size_t *last) {
+    size_t below_min, upto_max;
+    if (zs->encoding == ZSET_ENC_COMPACT) {
+        below_min = upto_max = 0;
+        ZEntry e;
+        for (size_t off = 0; off < zs->used; off += ZC_HEADER + e.mlen) {
+            zc_entry(zs->entries + off, &e);
+            if (e.score < range->min || (range->minex && e.score == range->min)) below_min++;
+            if (e.score < range->max || (!range->maxex && e.score == range->max)) upto_max++;
+        }
+    } else {
+        below_min = zsl_count_below(zs, range->min, range->minex);
+        upto_max = zsl_count_below(zs, range->max, !range->maxex);
+    }
+    if (upto_max <= below_min) return 0;
+    *first = below_min;
+    *last = upto_max - 1;
+    return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef MINIREDIS_TEST_H
+#define MINIREDIS_TEST_H
+
+// Minimal checks for the tests: report every failed condition, then
+// exit non-zero from main through test_result()
+
+#include <stdio.h>
+
+static int g_test_failures;
+
+#define CHECK(cond, ...)                                                   \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__);                                  \
+            fputc('\n', stderr);                                           \
+            g_test_failures++;                                             \
+        }                                                                  \
+    } while (0)
+
+static inline int test_result(const char *name) {
+    if (g_test_failures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, g_test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,124 @@
+// Expired keys across a restart: an AOF where keys got a TTL that has
+// since passed, followed by writes that keep the TTL (INCR, ZADD), must
+// load with those keys gone, not back without a TTL. Keys the store
+// expires after the load must be logged as DEL, so that a second load of
+// the same file agrees with the first.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "aof.h"
+#include "command.h"
+#include "resp.h"
+#include "server.h"
+#include "store.h"
+#include "test.h"
+
+static void add(FILE *f, int argc, const char *const *argv) {
+    fprintf(f, "*%d\r\n", argc);
+    for (int i = 0; i < argc; i++) fprintf(f, "$%zu\r\n%s\r\n", strlen(argv[i]), argv[i]);
+}
+
+#define ADD(f, ...)                                                  \
+    do {                                                             \
+        const char *argv_[] = {__VA_ARGS__};                         \
+        add(f, sizeof(argv_) / sizeof(argv_[0]), argv_);             \
+    } while (0)
+
+static void write_log(const char *path) {
+    char past[32], past2[32], future[32];
+    int64_t now = store_mstime();
+    sprintf(past, "%lld", (long long)(now - 1000));
+    sprintf(past2, "%lld", (long long)(now - 2000));
+    sprintf(future, "%lld", (long long)(now + 600000));
+
+    FILE *f = fopen(path, "w");
+    // Expired before the restart, then written with the TTL kept
+    ADD(f, "SET", "k", "5");
+    ADD(f, "PEXPIREAT", "k", past);
+    ADD(f, "INCR", "k");
+    ADD(f, "ZADD", "z", "1", "a");
+    ADD(f, "PEXPIREAT", "z", past);
+    ADD(f, "ZADD", "z", "2", "b");
+    // Still alive
+    ADD(f, "SET", "live", "1");
+    ADD(f, "PEXPIREAT", "live", future);
+    ADD(f, "INCR", "live");
+    // Expired while the server ran (hence the DEL), then created again
+    ADD(f, "SET", "again", "7");
+    ADD(f, "PEXPIREAT", "again", past2);
+    ADD(f, "DEL", "again");
+    ADD(f, "INCR", "again");
+    fclose(f);
+}
+
+static HNode *lookup(const char *key, int64_t *ttl) {
+    Slice k = slice_cstr(key);
+    HMap *map = store_lock(k);
+    HNode *node = hmap_lookup(map, k);
+    *ttl = hmap_get_expire(map, k);
+    store_unlock(map);
+    return node;
+}
+
+// Load the log in a fresh process and check what came back
+static void load_and_check(const char *path) {
+    resp_init();
+    command_table_init();
+    store_init();
+    aof_init(path);
+    server_load_aof();
+
+    int64_t ttl;
+    CHECK(lookup("k", &ttl) == NULL && ttl == HMAP_NO_KEY, "k came back (ttl %lld)", (long long)ttl);
+    CHECK(lookup("z", &ttl) == NULL && ttl == HMAP_NO_KEY, "z came back (ttl %lld)", (long long)ttl);
+
+    HNode *node = lookup("live", &ttl);
+    CHECK(node && hnode_int(node) == 2, "live should be 2");
+    CHECK(ttl > store_mstime(), "live lost its TTL (%lld)", (long long)ttl);
+
+    node = lookup("again", &ttl);
+    CHECK(node && hnode_int(node) == 1, "again should be 1");
+    CHECK(ttl == HMAP_NO_TTL, "again should have no TTL (%lld)", (long long)ttl);
+    aof_close();
+}
+
+static int run_child(const char *path) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        load_and_check(path);
+        _exit(g_test_failures ? 1 : 0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(void) {
+    char dir[] = "/tmp/miniredis-test-XXXXXX", path[64];
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/database.aof", dir);
+    write_log(path);
+
+    CHECK(run_child(path) == 0, "first load");
+
+    // The first load expired k and z: that is in the log now
+    FILE *f = fopen(path, "r");
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    CHECK(strstr(buf, "*2\r\n$3\r\nDEL\r\n$1\r\nk\r\n") != NULL, "no DEL k logged");
+    CHECK(strstr(buf, "*2\r\n$3\r\nDEL\r\n$1\r\nz\r\n") != NULL, "no DEL z logged");
+
+    CHECK(run_child(path) == 0, "second load");
+
+    unlink(path);
+    rmdir(dir);
+    return test_result("test_aof_expire");
+}
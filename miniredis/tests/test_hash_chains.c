@@ -0,0 +1,135 @@
+// Key hash quality: hash 2^20 keys of several shapes (sequential names,
+// numbers, binary counters, long shared prefixes, 3-byte keys) into 2^20
+// buckets and check the bucket loads follow the Poisson(1) law a random
+// hash gives: about e^-1 of the buckets empty, about 1.9% holding four or
+// more keys, and no long chains. The bits the store uses elsewhere are
+// checked too: the top four pick the shard, the low seven are the Swiss
+// table tags. With the chained engine the chains of a real table are
+// measured as well.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "store.h"
+#include "test.h"
+
+#define NBITS 20
+#define NKEYS (1u << NBITS)
+#define MAX_CHAIN 15 // Expected max is about 9; 15 has odds below 1e-6
+
+typedef int (*key_fn)(char *buf, uint32_t i);
+
+static int key_name(char *buf, uint32_t i) { return sprintf(buf, "key:%u", i); }
+static int key_number(char *buf, uint32_t i) { return sprintf(buf, "%u", i); }
+static int key_long_prefix(char *buf, uint32_t i) {
+    memset(buf, 'p', 90);
+    return 90 + sprintf(buf + 90, "%010u", i);
+}
+static int key_binary(char *buf, uint32_t i) {
+    uint64_t v = i;
+    memcpy(buf, &v, sizeof(v));
+    return sizeof(v);
+}
+static int key_3bytes(char *buf, uint32_t i) {
+    buf[0] = (char)i;
+    buf[1] = (char)(i >> 8);
+    buf[2] = (char)(i >> 16);
+    return 3;
+}
+
+static const struct {
+    const char *name;
+    key_fn fn;
+} k_shapes[] = {
+    {"key:N", key_name},
+    {"N", key_number},
+    {"100-byte prefix+N", key_long_prefix},
+    {"8-byte binary", key_binary},
+    {"3-byte binary", key_3bytes},
+};
+
+// Check bucket loads against Poisson(1)
+static void check_loads(const char *what, const uint8_t *load, size_t nbuckets) {
+    size_t empty = 0, four_plus = 0, max = 0;
+    for (size_t i = 0; i < nbuckets; i++) {
+        empty += load[i] == 0;
+        four_plus += load[i] >= 4;
+        if (load[i] > max) max = load[i];
+    }
+    double empty_frac = (double)empty / nbuckets;
+    double four_frac = (double)four_plus / nbuckets;
+    double want_four = 1 - exp(-1) * (1 + 1 + 0.5 + 1.0 / 6);
+    printf("  %-24s empty %.4f (want %.4f)  4+ %.4f (want %.4f)  max %zu\n", what, empty_frac,
+           exp(-1), four_frac, want_four, max);
+    CHECK(fabs(empty_frac - exp(-1)) < 0.005, "%s: empty fraction %.4f", what, empty_frac);
+    CHECK(fabs(four_frac - want_four) < 0.003, "%s: 4+ fraction %.4f", what, four_frac);
+    CHECK(max <= MAX_CHAIN, "%s: longest chain %zu", what, max);
+}
+
+static void check_shape(const char *name, key_fn fn, uint8_t *load) {
+    size_t shards[16] = {0}, tags[128] = {0};
+    uint8_t *swiss = calloc(NKEYS, 1);
+    char buf[128];
+    memset(load, 0, NKEYS);
+
+    for (uint32_t i = 0; i < NKEYS; i++) {
+        uint64_t h = hmap_hash((Slice){buf, (size_t)fn(buf, i)});
+        if (load[h & (NKEYS - 1)] < 255) load[h & (NKEYS - 1)]++;
+        if (swiss[(h >> 7) & (NKEYS - 1)] < 255) swiss[(h >> 7) & (NKEYS - 1)]++;
+        shards[h >> 60]++;
+        tags[h & 0x7f]++;
+    }
+    printf("%s\n", name);
+    check_loads("bucket (h & mask)", load, NKEYS);
+    check_loads("swiss group (h >> 7)", swiss, NKEYS);
+
+    for (int s = 0; s < 16; s++) {
+        CHECK(fabs(shards[s] - NKEYS / 16.0) < NKEYS / 16.0 * 0.02, "%s: shard %d has %zu keys",
+              name, s, shards[s]);
+    }
+    for (int t = 0; t < 128; t++) {
+        CHECK(fabs(tags[t] - NKEYS / 128.0) < NKEYS / 128.0 * 0.05, "%s: tag %d seen %zu times",
+              name, t, tags[t]);
+    }
+    free(swiss);
+}
+
+#ifndef HMAP_SWISS
+// Chains of an actual table, once its size has settled at NKEYS buckets
+static void check_table(uint8_t *load) {
+    HMap map;
+    hmap_init(&map);
+    char buf[32];
+    for (uint32_t i = 0; i < NKEYS - 1; i++) {
+        hmap_insert(&map, (Slice){buf, (size_t)key_name(buf, i)}, (Slice){"v", 1});
+    }
+    while (hmap_rehash(&map, SIZE_MAX)) {}
+    CHECK(map.newer.size == NKEYS, "table has %zu buckets", map.newer.size);
+
+    for (size_t i = 0; i < map.newer.size && i < NKEYS; i++) {
+        size_t len = 0;
+        for (HNode *node = map.newer.tab[i]; node; node = node->next) len++;
+        load[i] = len < 255 ? len : 255;
+    }
+    printf("chained table\n");
+    check_loads("chains", load, NKEYS);
+    hmap_destroy(&map);
+}
+#endif
+
+int main(void) {
+    HMap seed; // hmap_init picks the hash seed
+    hmap_init(&seed);
+    uint8_t *load = malloc(NKEYS);
+
+    for (size_t i = 0; i < sizeof(k_shapes) / sizeof(k_shapes[0]); i++) {
+        check_shape(k_shapes[i].name, k_shapes[i].fn, load);
+    }
+#ifndef HMAP_SWISS
+    check_table(load);
+#endif
+
+    free(load);
+    hmap_destroy(&seed);
+    return test_result("test_hash_chains");
+}
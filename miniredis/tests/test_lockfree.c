@@ -0,0 +1,200 @@
+// Lock-free GET under write churn: writer threads SET, DEL and EXPIRE a
+// small keyspace (so nodes are unlinked, retired, freed and reused all the
+// time, and the table grows and shrinks) while reader threads GET it the
+// way the server does: store_lookup_lockfree inside a read section, the
+// shard lock when it declines. Every value names its key and a sequence
+// number and is padded to a length and byte derived from that number, so
+// a reader can tell a whole value from a torn or reused one. Some hits are
+// pinned inside the read section and checked again after it, as a
+// zero-copy GET reply does. Built with -DSLAB_POISON, freed nodes and
+// tables are overwritten first, so a node read after it was freed fails
+// the same checks.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "store.h"
+#include "test.h"
+
+#define NKEYS 4096
+#define WRITERS 2
+#define READERS 4
+#define RUN_MS 2000
+
+typedef struct Reader {
+    pthread_t tid;
+    uint64_t rng;
+    long lockfree;  // Lookups answered without the lock
+    long locked;    // Lookups the lock-free path declined
+    long hits;
+    long pinned;    // Hits checked again after the read section
+    long bad;       // Torn, misplaced or freed values seen
+} Reader;
+
+static volatile int g_stop;
+
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int key_of(char *buf, uint32_t k) {
+    return sprintf(buf, "key:%u", k);
+}
+
+// "<key>|<seq>|" then filler: 8 to 1000 bytes of one letter, both picked by seq
+static size_t value_of(char *buf, const char *key, uint64_t seq) {
+    size_t len = sprintf(buf, "%s|%llu|", key, (unsigned long long)seq);
+    size_t pad = 8 + seq * 7919 % 993;
+    memset(buf + len, 'a' + (int)(seq % 26), pad);
+    return len + pad;
+}
+
+// A value is whole if it is exactly what value_of gives for its own seq
+static int value_ok(const char *key, size_t klen, const char *val, size_t vlen) {
+    char want[1100];
+    if (vlen < klen + 2 || vlen >= sizeof(want) || memcmp(val, key, klen) != 0 ||
+        val[klen] != '|') {
+        return 0;
+    }
+    char *end;
+    unsigned long long seq = strtoull(val + klen + 1, &end, 10);
+    if (end == val + klen + 1 || (size_t)(end - val) >= vlen || *end != '|') return 0;
+    char kbuf[32];
+    memcpy(kbuf, key, klen);
+    kbuf[klen] = '\0';
+    return value_of(want, kbuf, seq) == vlen && memcmp(want, val, vlen) == 0;
+}
+
+static int node_ok(HNode *node, Slice key) {
+    return node->klen == key.len && memcmp(hnode_key(node), key.ptr, key.len) == 0 &&
+           node->encoding == HNODE_ENC_RAW &&
+           value_ok(key.ptr, key.len, hnode_value(node), node->vlen);
+}
+
+static void *writer_main(void *arg) {
+    uint64_t rng = (uint64_t)(uintptr_t)arg;
+    uint64_t seq = (uint64_t)(uintptr_t)arg << 40;
+    char key[32], value[1100];
+    for (long i = 0; !g_stop; i++) {
+        uint64_t r = rng_next(&rng);
+        Slice k = {key, (size_t)key_of(key, r % NKEYS)};
+        HMap *map = store_lock(k);
+        switch ((r >> 32) % 8) {
+        case 0:
+        case 1:
+            hmap_delete(map, k);
+            break;
+        case 2:
+            // Half already due, so the next locked GET expires the key lazily
+            hmap_set_expire(map, k, store_mstime() + ((r >> 40) & 1 ? 50 : -1));
+            break;
+        case 3:
+            hmap_persist(map, k);
+            break;
+        default:
+            hmap_insert(map, k, (Slice){value, value_of(value, key, seq++)});
+        }
+        store_unlock(map);
+
+        if (i % 256 == 0) {
+            store_expire_cycle(0, 1, 100);
+            store_rehash(0, 1, 100);
+            store_reclaim(0, 1);
+        }
+        // Now and then empty out a stretch of keys, so the table shrinks
+        if (i % 100000 == 99999) {
+            for (uint32_t j = 0; j < NKEYS / 2; j++) {
+                k.len = key_of(key, (r + j) % NKEYS);
+                map = store_lock(k);
+                hmap_delete(map, k);
+                store_unlock(map);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *reader_main(void *arg) {
+    Reader *rd = arg;
+    char key[32];
+    store_thread_init();
+    while (!g_stop) {
+        Slice k = {key, (size_t)key_of(key, rng_next(&rd->rng) % NKEYS)};
+        HNode *node;
+        store_read_begin();
+        if (store_lookup_lockfree(k, &node)) {
+            rd->lockfree++;
+            if (node) {
+                rd->hits++;
+                rd->bad += !node_ok(node, k);
+            }
+            if (node && rd->hits % 4 == 0) {
+                hnode_retain(node);
+                store_read_end();
+                rd->pinned++;
+                rd->bad += !node_ok(node, k);
+                hnode_release(node);
+            } else {
+                store_read_end();
+            }
+            continue;
+        }
+        store_read_end();
+
+        rd->locked++;
+        HMap *map = store_lock(k);
+        node = hmap_lookup(map, k);
+        if (node) {
+            rd->hits++;
+            rd->bad += !node_ok(node, k);
+        }
+        store_unlock(map);
+    }
+    return NULL;
+}
+
+int main(void) {
+    store_init();
+    if (!store_enable_lockfree_reads()) {
+        printf("test_lockfree: skipped (no lock-free reads with this hash engine)\n");
+        return 0;
+    }
+
+    pthread_t writers[WRITERS];
+    Reader readers[READERS];
+    memset(readers, 0, sizeof(readers));
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_create(&writers[i], NULL, writer_main, (void *)(uintptr_t)(i + 1));
+    }
+    for (int i = 0; i < READERS; i++) {
+        readers[i].rng = 0x9e3779b97f4a7c15ull * (i + 1);
+        pthread_create(&readers[i].tid, NULL, reader_main, &readers[i]);
+    }
+
+    struct timespec ts = {RUN_MS / 1000, RUN_MS % 1000 * 1000000L};
+    nanosleep(&ts, NULL);
+    g_stop = 1;
+    for (int i = 0; i < WRITERS; i++) pthread_join(writers[i], NULL);
+
+    long lockfree = 0, locked = 0, hits = 0, pinned = 0, bad = 0;
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i].tid, NULL);
+        lockfree += readers[i].lockfree;
+        locked += readers[i].locked;
+        hits += readers[i].hits;
+        pinned += readers[i].pinned;
+        bad += readers[i].bad;
+    }
+    printf("  %ld lookups (%ld lock-free, %ld locked), %ld hits (%ld pinned), %ld bad values\n",
+           lockfree + locked, lockfree, locked, hits, pinned, bad);
+    CHECK(bad == 0, "%ld torn or freed values read", bad);
+    CHECK(lockfree > 0 && locked > 0, "both read paths should run (%ld lock-free, %ld locked)",
+          lockfree, locked);
+    CHECK(hits > 0, "no lookup found a key");
+    CHECK(pinned > 0, "no lock-free hit was pinned");
+    return test_result("test_lockfree");
+}